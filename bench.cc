@@ -0,0 +1,671 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+// Micro-benchmarks for the header-only hot paths.
+//
+//     make bench                     # table
+//     make bench BENCH_ARGS=--json   # one JSON object per line
+//     make bench BENCH_ARGS=describe # only benchmarks whose name matches
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "describe.h"
+#include "dns.h"
+#include "match.h"
+#include "socket.h"
+
+using namespace mcast;
+
+namespace legacy {
+
+// describe() as it was before it wrote into a reusable buffer, kept here
+// as the baseline.
+std::string get_current_time_description() {
+    std::stringstream str{};
+
+    const auto now{std::chrono::system_clock::now()};
+    const auto epoch_us{std::chrono::duration_cast<std::chrono::microseconds>(
+            now.time_since_epoch()).count()};
+    const time_t epoch_s{epoch_us / 1'000'000};
+    str << "@" << epoch_s << "." << (epoch_us % 1'000'000);
+
+    const auto cal_local_s{*(std::localtime(&epoch_s))};
+    str << " " << std::put_time(&cal_local_s, "%Y-%m-%d %H:%M:%S")
+        << "." << (epoch_us % 1'000'000);
+
+    return str.str();
+}
+
+std::string describe(const struct sockaddr_storage& from,
+                     const socket::AuxiliaryData& aux,
+                     const uint8_t* data, ssize_t rcvd) {
+    const std::string indent_short{"  "};
+    const std::string indent_long{"    "};
+
+    if (rcvd < 0) {
+        return "error (see POSIX errno message)";
+    }
+
+    std::stringstream str{};
+
+    str << get_current_time_description();
+    str << "\nreceived " << rcvd
+        << " bytes from " << socket::to_string(from);
+
+    if (socket::has_hoplimit(aux)) {
+        str << "\n" << indent_short << "hops: " << socket::get_hoplimit(aux);
+    }
+    if (socket::has_dscp(aux)) {
+        str << "\n" << indent_short << "dscp: " << socket::get_dscp(aux);
+    }
+    if (socket::has_pktinfo(aux)) {
+        const unsigned ifindex{socket::get_pktinfo_interface(aux)};
+        str << "\n" << indent_short
+                    << "intf: " << socket::if_index2name(ifindex)
+                    << " (" << ifindex << ")";
+    }
+
+    const int bytes_per_line{16};
+    char buf[3]{};
+    for (int i = 0; i < rcvd; i += bytes_per_line) {
+        if (i == 0) str << "\n" << indent_short << "data:";
+        str << "\n";
+
+        // Print bytes as lowercase hexadecimal.
+        str << indent_long;
+        for (int j = 0; j < bytes_per_line; j++) {
+            if (j % 2 == 0) str << " ";
+            if (j % 8 == 0) str << " ";
+            if (i + j < rcvd) {
+                std::snprintf(buf, 3, "%02x", data[i + j]);
+            } else {
+                buf[0] = ' ';
+                buf[1] = ' ';
+            }
+            buf[2] = '\0';
+            str << buf;
+        }
+
+        // Print any bytes that look like printable characters.
+        str << indent_long;
+        for (int j = 0; j < bytes_per_line && (i + j < rcvd); j++) {
+            if (j % 2 == 0) str << " ";
+            if (j % 8 == 0) str << " ";
+            if (std::isgraph(data[i + j]) != 0) {
+                std::snprintf(buf, 2, "%c", data[i + j]);
+            } else {
+                buf[0] = '.';
+            }
+            buf[1] = '\0';
+            str << buf;
+        }
+    }
+
+    str << "\n";
+    return str.str();
+}
+
+}  // namespace legacy
+
+// Count heap allocations, so that benchmarks can report allocs/op.
+namespace {
+std::atomic<uint64_t> allocations{0};
+}
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Result {
+    std::string name{};
+    uint64_t iterations{0};
+    double ns_per_op{0};
+    double allocs_per_op{0};
+    size_t bytes_per_op{0};  // for throughput; 0 if not meaningful
+};
+
+struct Options {
+    bool json{false};
+    std::string filter{};
+};
+
+// Defeat dead-code elimination.
+volatile size_t sink_bytes{0};
+
+// Run fn(i) in growing rounds until a round takes at least 200 ms, and
+// report the last one.
+template<typename Fn>
+Result measure(const std::string& name, size_t bytes_per_op, Fn&& fn) {
+    Result r{name, 0, 0, 0, bytes_per_op};
+    for (uint64_t n = 16;; n *= 2) {
+        const uint64_t allocs_before{allocations.load()};
+        const auto start{std::chrono::steady_clock::now()};
+        for (uint64_t i = 0; i < n; i++) {
+            fn(i);
+        }
+        const auto elapsed{std::chrono::steady_clock::now() - start};
+        const double ns{static_cast<double>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        elapsed).count())};
+        if (ns >= 200e6 || n >= (uint64_t{1} << 32)) {
+            r.iterations = n;
+            r.ns_per_op = ns / static_cast<double>(n);
+            r.allocs_per_op = static_cast<double>(
+                    allocations.load() - allocs_before) / static_cast<double>(n);
+            return r;
+        }
+    }
+}
+
+void print(const Options& opts, const Result& r) {
+    const double mb_per_s{(r.bytes_per_op > 0)
+            ? static_cast<double>(r.bytes_per_op) * 1e3 / r.ns_per_op : 0};
+    if (opts.json) {
+        std::printf("{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,"
+                    "\"allocs_per_op\":%.3f,\"bytes_per_op\":%zu,"
+                    "\"mb_per_s\":%.1f}\n",
+                    r.name.c_str(),
+                    static_cast<unsigned long long>(r.iterations),
+                    r.ns_per_op, r.allocs_per_op, r.bytes_per_op, mb_per_s);
+    } else {
+        std::printf("%-32s %12.1f %10.2f %10.1f\n", r.name.c_str(),
+                    r.ns_per_op, r.allocs_per_op, mb_per_s);
+    }
+    std::fflush(stdout);
+}
+
+// Everything after the timestamp line, which legitimately differs.
+std::string body(const std::string& record) {
+    const auto nl{record.find('\n')};
+    return (nl == std::string::npos) ? record : record.substr(nl);
+}
+
+template<typename T>
+void add_cmsg(struct msghdr& mhdr, struct cmsghdr*& cmsg,
+              int level, int type, const T& value) {
+    cmsg = (cmsg == nullptr) ? CMSG_FIRSTHDR(&mhdr) : CMSG_NXTHDR(&mhdr, cmsg);
+    cmsg->cmsg_level = level;
+    cmsg->cmsg_type = type;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(value));
+    memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+}
+
+// DNS messages assembled by hand, compression and all.
+struct DnsBuilder {
+    std::vector<uint8_t> b{};
+
+    void u8(uint8_t v) { b.push_back(v); }
+    void u16(uint16_t v) { u8(v >> 8); u8(v & 0xff); }
+    void u32(uint32_t v) { u16(v >> 16); u16(v & 0xffff); }
+    // Dotted labels, then either a pointer to a name already written or
+    // the root. Returns where the name starts.
+    size_t name(const std::string& labels, int pointer = -1) {
+        const size_t start{b.size()};
+        size_t from{0};
+        while (from < labels.size()) {
+            size_t dot{labels.find('.', from)};
+            if (dot == std::string::npos) dot = labels.size();
+            u8(static_cast<uint8_t>(dot - from));
+            b.insert(b.end(), labels.begin() + from, labels.begin() + dot);
+            from = dot + 1;
+        }
+        if (pointer >= 0) {
+            u16(static_cast<uint16_t>(0xc000 | pointer));
+        } else {
+            u8(0);
+        }
+        return start;
+    }
+    void header(uint16_t id, uint16_t flags, uint16_t qd, uint16_t an,
+                uint16_t ns, uint16_t ar) {
+        u16(id); u16(flags); u16(qd); u16(an); u16(ns); u16(ar);
+    }
+    // Type, class, TTL and an rdlength to be filled in by end_rdata().
+    size_t rr(uint16_t type, uint16_t klass, uint32_t ttl) {
+        u16(type); u16(klass); u32(ttl); u16(0);
+        return b.size();
+    }
+    void end_rdata(size_t rdata) {
+        const size_t n{b.size() - rdata};
+        b[rdata - 2] = static_cast<uint8_t>(n >> 8);
+        b[rdata - 1] = static_cast<uint8_t>(n & 0xff);
+    }
+    void strings(std::initializer_list<std::string> strs) {
+        for (const auto& str : strs) {
+            u8(static_cast<uint8_t>(str.size()));
+            b.insert(b.end(), str.begin(), str.end());
+        }
+    }
+};
+
+// A Chromecast-style mDNS announcement, a DNS-SD browse and a unicast DNS
+// answer with EDNS: what a LAN's 5353 and 53 mostly carry.
+std::vector<std::vector<uint8_t>> dns_messages() {
+    std::vector<std::vector<uint8_t>> messages{};
+
+    DnsBuilder announce{};
+    announce.header(0, 0x8400, 0, 4, 0, 2);
+    const size_t service{announce.name("_googlecast._tcp.local")};
+    const size_t local{service + 17};
+    size_t rdata{announce.rr(dns::PTR, 1, 120)};
+    const size_t instance{announce.name("Living Room TV-3f2a", service)};
+    announce.end_rdata(rdata);
+    announce.name("", instance);
+    rdata = announce.rr(dns::SRV, 0x8001, 120);
+    announce.u16(0); announce.u16(0); announce.u16(8009);
+    const size_t host{announce.name("3f2a9c1e-5b7d", local)};
+    announce.end_rdata(rdata);
+    announce.name("", instance);
+    rdata = announce.rr(dns::TXT, 0x8001, 4500);
+    announce.strings({"id=3f2a9c1e5b7d4e0f", "cd=C0FFEE", "rm=", "ve=05",
+                      "md=Chromecast", "ic=/setup/icon.png",
+                      "fn=Living Room TV", "ca=201221", "st=0", "bs=FA8F",
+                      "nf=1", "rs="});
+    announce.end_rdata(rdata);
+    announce.name("", host);
+    rdata = announce.rr(dns::A, 0x8001, 120);
+    announce.u32(0xc0a8010a);
+    announce.end_rdata(rdata);
+    announce.name("", host);
+    rdata = announce.rr(dns::AAAA, 0x8001, 120);
+    announce.u16(0xfe80);
+    for (int i = 0; i < 6; i++) announce.u16(0);
+    announce.u16(1);
+    announce.end_rdata(rdata);
+    announce.name("", instance);
+    rdata = announce.rr(dns::NSEC, 0x8001, 4500);
+    announce.name("", instance);
+    announce.u8(0); announce.u8(5); announce.u32(0); announce.u8(0x80);
+    announce.end_rdata(rdata);
+    messages.push_back(announce.b);
+
+    DnsBuilder browse{};
+    browse.header(0, 0, 3, 0, 0, 0);
+    const size_t services{browse.name("_services._dns-sd._udp.local")};
+    browse.u16(dns::PTR); browse.u16(0x8001);
+    browse.name("_airplay._tcp", services + 23);
+    browse.u16(dns::PTR); browse.u16(1);
+    browse.name("_googlecast._tcp", services + 23);
+    browse.u16(dns::PTR); browse.u16(1);
+    messages.push_back(browse.b);
+
+    DnsBuilder answer{};
+    answer.header(0x1234, 0x8180, 1, 2, 0, 1);
+    const size_t qname{answer.name("www.example.com")};
+    answer.u16(dns::A); answer.u16(1);
+    answer.name("", qname);
+    rdata = answer.rr(dns::CNAME, 1, 300);
+    const size_t cname{answer.name("edge", qname + 4)};
+    answer.end_rdata(rdata);
+    answer.name("", cname);
+    rdata = answer.rr(dns::A, 1, 60);
+    answer.u32(0x5db8d822);
+    answer.end_rdata(rdata);
+    answer.u8(0);
+    rdata = answer.rr(dns::OPT, 1232, 0);
+    answer.end_rdata(rdata);
+    messages.push_back(answer.b);
+
+    return messages;
+}
+
+// Each message, and for each many damaged copies of it: bytes flipped,
+// counts inflated, pointers aimed at random, cut short; then noise.
+std::vector<std::vector<uint8_t>> dns_corpus(
+        const std::vector<std::vector<uint8_t>>& messages, std::mt19937& rng) {
+    std::vector<std::vector<uint8_t>> corpus{messages};
+    for (const auto& message : messages) {
+        for (int i = 0; i < 300; i++) {
+            auto damaged{message};
+            switch (i % 4) {
+                case 0:
+                    for (uint32_t n = 1 + rng() % 4; n > 0; n--) {
+                        damaged[rng() % damaged.size()] ^=
+                                static_cast<uint8_t>(1 + rng() % 255);
+                    }
+                    break;
+                case 1:
+                    damaged[4 + rng() % 8] = static_cast<uint8_t>(rng());
+                    break;
+                case 2: {
+                    const size_t at{dns::kHeaderSize +
+                                    rng() % (damaged.size() - dns::kHeaderSize - 1)};
+                    damaged[at] = static_cast<uint8_t>(0xc0 | (rng() & 0x3f));
+                    damaged[at + 1] = static_cast<uint8_t>(rng());
+                    break;
+                }
+                case 3:
+                    damaged.resize(rng() % damaged.size());
+                    break;
+            }
+            corpus.push_back(damaged);
+        }
+    }
+    for (int i = 0; i < 100; i++) {
+        std::vector<uint8_t> noise(rng() % 512);
+        for (auto& b : noise) b = static_cast<uint8_t>(rng());
+        corpus.push_back(noise);
+    }
+    return corpus;
+}
+
+// What a listen socket typically gets with each IPv4 datagram.
+void fill_typical_cmsgs(socket::Msg& msg) {
+    struct msghdr mhdr{};
+    mhdr.msg_control = msg.cmsg;
+    mhdr.msg_controllen = sizeof(msg.cmsg);
+    struct cmsghdr* cmsg{nullptr};
+
+    struct in_pktinfo pi{};
+    pi.ipi_ifindex = 1;
+    add_cmsg(mhdr, cmsg, IPPROTO_IP, IP_PKTINFO, pi);
+    add_cmsg(mhdr, cmsg, IPPROTO_IP, IP_TTL, int{64});
+    add_cmsg(mhdr, cmsg, IPPROTO_IP, IP_TOS, uint8_t{0});
+#ifdef SCM_TIMESTAMPNS
+    struct timespec ts{};
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    add_cmsg(mhdr, cmsg, SOL_SOCKET, SCM_TIMESTAMPNS, ts);
+#endif
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options opts{};
+    for (int i = 1; i < argc; i++) {
+        const std::string arg{argv[i]};
+        if (arg == "--json") {
+            opts.json = true;
+        } else {
+            opts.filter = arg;
+        }
+    }
+    const auto wanted = [&opts](const std::string& name) {
+        return opts.filter.empty() || name.find(opts.filter) != std::string::npos;
+    };
+    const auto run = [&](const std::string& name, size_t bytes_per_op,
+                         auto&& fn) {
+        if (wanted(name)) print(opts, measure(name, bytes_per_op, fn));
+    };
+
+    struct sockaddr_storage from{};
+    auto* sin{reinterpret_cast<struct sockaddr_in*>(&from)};
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(0xc0000201);  // 192.0.2.1
+    sin->sin_port = htons(4242);
+
+    struct sockaddr_storage from6{};
+    auto* sin6{reinterpret_cast<struct sockaddr_in6*>(&from6)};
+    sin6->sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::1:2:3:4", &(sin6->sin6_addr));
+    sin6->sin6_port = htons(4242);
+
+    socket::AuxiliaryData aux{};
+    aux.hoplimit = 64;
+    aux.dscp = 0;
+    struct in_pktinfo pi{};
+    pi.ipi_ifindex = 1;
+    aux.pktinfo = pi;
+
+    std::mt19937 rng{42};
+    std::vector<uint8_t> data(2048);
+    for (auto& b : data) b = static_cast<uint8_t>(rng());
+
+    // describe_into() must produce the same output as the original, for
+    // every length, including partial last lines.
+    std::string record{};
+    for (ssize_t len = 0; len <= 1472; len++) {
+        describe_into(record, from, aux, data.data(), len);
+        if (body(record) != body(legacy::describe(from, aux, data.data(),
+                                                  len))) {
+            std::cerr << "describe: output differs at length " << len << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (not opts.json) {
+        std::printf("%-32s %12s %10s %10s\n",
+                    "benchmark", "ns/op", "allocs/op", "MB/s");
+    }
+
+    auto msg{std::make_unique<socket::Msg>()};
+    fill_typical_cmsgs(*msg);
+    run("parse_aux", 0, [&](uint64_t) {
+        const auto parsed{socket::parse_aux(*msg)};
+        sink_bytes = sink_bytes + parsed.hoplimit.value_or(0);
+    });
+
+    for (const size_t len : {64, 512, 1400}) {
+        const std::string suffix{"/" + std::to_string(len)};
+        run("describe_legacy" + suffix, len, [&](uint64_t) {
+            sink_bytes = sink_bytes + legacy::describe(
+                    from, aux, data.data(), len).size();
+        });
+        run("describe" + suffix, len, [&](uint64_t) {
+            sink_bytes = sink_bytes + describe(
+                    from, aux, data.data(), len).size();
+        });
+        run("describe_into" + suffix, len, [&](uint64_t) {
+            describe_into(record, from, aux, data.data(), len);
+            sink_bytes = sink_bytes + record.size();
+        });
+        run("hexdump" + suffix, len, [&](uint64_t) {
+            record.clear();
+            hexdump::append(record, data.data(), len);
+            sink_bytes = sink_bytes + record.size();
+        });
+    }
+
+    run("to_string/ipv4", 0, [&](uint64_t) {
+        sink_bytes = sink_bytes + socket::to_string(from).size();
+    });
+    run("to_string/ipv6", 0, [&](uint64_t) {
+        sink_bytes = sink_bytes + socket::to_string(from6).size();
+    });
+
+    run("clear/Msg", sizeof(socket::Msg), [&](uint64_t) {
+        socket::clear(*msg);
+        sink_bytes = sink_bytes + msg->pckt[0];
+    });
+    auto jumbo{std::make_unique<socket::JumboMsg>()};
+    run("clear/JumboMsg", sizeof(socket::JumboMsg), [&](uint64_t) {
+        socket::clear(*jumbo);
+        sink_bytes = sink_bytes + jumbo->pckt[0];
+    });
+
+    // Lowercase words against lowercase text, where nearly every byte can
+    // start a pattern, and against random bytes, where most cannot. Each
+    // payload has one planted pattern, which must be found.
+    std::vector<uint8_t> text(1400);
+    for (auto& b : text) {
+        b = static_cast<uint8_t>((rng() % 6 == 0) ? ' ' : 'a' + rng() % 26);
+    }
+    for (const size_t count : {10, 300}) {
+        std::vector<match::Pattern> patterns{};
+        std::string complaint{};
+        for (size_t i = 0; i < count; i++) {
+            std::string word{};
+            for (size_t n = 6 + rng() % 7; n > 0; n--) {
+                word.push_back(static_cast<char>('a' + rng() % 26));
+            }
+            match::add(patterns, word, complaint);
+        }
+        const auto matcher{match::build(patterns)};
+        const std::string& planted{matcher.patterns[count / 2].text};
+        std::vector<uint8_t> binary(1400);
+        memcpy(binary.data(), data.data(), binary.size());
+        for (auto* payload : {&text, &binary}) {
+            memcpy(payload->data() + 700, planted.data(), planted.size());
+            bool found{false};
+            match::scan(matcher, payload->data(), payload->size(),
+                        [&found](const match::Match& m) {
+                            found = found || m.offset == 700;
+                            return true;
+                        });
+            if (not found) {
+                std::cerr << "match: planted pattern not found\n";
+                return EXIT_FAILURE;
+            }
+        }
+
+        std::vector<match::Match> matches{};
+        const std::string suffix{"/" + std::to_string(count)};
+        run("match_text" + suffix, text.size(), [&](uint64_t) {
+            match::all(matcher, text.data(), text.size(), matches);
+            sink_bytes = sink_bytes + matches.size();
+        });
+        run("match_binary" + suffix, binary.size(), [&](uint64_t) {
+            match::all(matcher, binary.data(), binary.size(), matches);
+            sink_bytes = sink_bytes + matches.size();
+        });
+    }
+
+    // One pattern per byte value: every byte gets a class of its own, and
+    // every byte of a payload must match the pattern for it.
+    {
+        std::vector<match::Pattern> patterns{};
+        std::string complaint{};
+        for (int b = 0; b < 256; b++) {
+            char hex[8]{};
+            snprintf(hex, sizeof(hex), "hex:%02x", b);
+            match::add(patterns, hex, complaint);
+        }
+        const auto matcher{match::build(patterns)};
+        size_t matched{0};
+        match::scan(matcher, data.data(), data.size(),
+                    [&](const match::Match& m) {
+                        if (m.offset == matched && m.pattern == data[m.offset]) {
+                            matched++;
+                        }
+                        return true;
+                    });
+        if (matched != data.size()) {
+            std::cerr << "match: all-bytes pattern set missed at "
+                      << matched << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // DNS decoding, over well-formed messages and a corpus of damaged
+    // ones. Every well-formed message must parse; nothing in the corpus
+    // may crash the parser or the summary.
+    const auto dns_valid{dns_messages()};
+    const auto corpus{dns_corpus(dns_valid, rng)};
+    dns::Message dns_msg{};
+    for (const auto& message : dns_valid) {
+        if (not error::ok(dns::parse(message.data(), message.size(),
+                                     dns_msg)) ||
+            dns_msg.count != dns::total_records(dns_msg)) {
+            std::cerr << "dns: well-formed message rejected\n";
+            return EXIT_FAILURE;
+        }
+    }
+    size_t corpus_bytes{0};
+    for (const auto& message : corpus) {
+        corpus_bytes += message.size();
+        if (error::ok(dns::parse(message.data(), message.size(), dns_msg))) {
+            record.clear();
+            dns::append_summary(record, dns_msg, "  ");
+        }
+    }
+
+    struct sockaddr_storage mdns_from{from};
+    reinterpret_cast<struct sockaddr_in*>(&mdns_from)->sin_port = htons(5353);
+    const auto& announce{dns_valid[0]};
+    run("dns_parse/mdns", announce.size(), [&](uint64_t) {
+        dns::parse(announce.data(), announce.size(), dns_msg);
+        sink_bytes = sink_bytes + dns_msg.count;
+    });
+    run("dns_parse/corpus", corpus_bytes / corpus.size(), [&](uint64_t i) {
+        const auto& message{corpus[i % corpus.size()]};
+        dns::parse(message.data(), message.size(), dns_msg);
+        sink_bytes = sink_bytes + dns_msg.count;
+    });
+    run("dns_summary/mdns", announce.size(), [&](uint64_t) {
+        dns::parse(announce.data(), announce.size(), dns_msg);
+        record.clear();
+        dns::append_summary(record, dns_msg, "  ");
+        sink_bytes = sink_bytes + record.size();
+    });
+    run("describe_into/mdns", announce.size(), [&](uint64_t) {
+        describe_into(record, mdns_from, aux, announce.data(),
+                      announce.size());
+        sink_bytes = sink_bytes + record.size();
+    });
+
+    // sendmsg() to ourselves over loopback, then recvmsg() it back.
+    if (wanted("loopback")) {
+        auto rx_or{socket::makeIPv4()};
+        auto tx_or{socket::makeIPv4()};
+        if (not ok(rx_or) || not ok(tx_or)) {
+            std::cerr << "loopback: " << to_string(rx_or) << "\n";
+            return EXIT_FAILURE;
+        }
+        auto& rx{get_valueref_unsafe(rx_or)};
+        auto& tx{get_valueref_unsafe(tx_or)};
+
+        struct sockaddr_storage lo{};
+        auto* lo4{reinterpret_cast<struct sockaddr_in*>(&lo)};
+        lo4->sin_family = AF_INET;
+        lo4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (const auto& e : {
+                 socket::bind(rx, *lo4),
+                 socket::enable(rx, IPPROTO_IP, IP_PKTINFO),
+                 socket::enable(rx, IPPROTO_IP, IP_RECVTTL),
+             }) {
+            if (not error::ok(e)) {
+                std::cerr << "loopback: " << error::to_string(e) << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+        socklen_t lo_len{sizeof(lo)};
+        ::getsockname(rx.fd, socket::sockaddr_ptr(lo), &lo_len);
+        if (not error::ok(socket::connect(tx, lo))) {
+            std::cerr << "loopback: cannot connect\n";
+            return EXIT_FAILURE;
+        }
+
+        auto out{std::make_unique<socket::Msg>()};
+        for (const size_t len : {64, 1400}) {
+            memcpy(out->pckt, data.data(), len);
+            run("loopback/" + std::to_string(len), len, [&](uint64_t) {
+                socket::sendmsg(tx, *out, len);
+                const auto rval{socket::recvmsg(rx, *msg)};
+                sink_bytes = sink_bytes + (ok(rval) ? msg->pckt[0] : 0);
+            });
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_BPF_H
+#define MCAST_BPF_H
+
+#ifdef __linux__
+#include <linux/filter.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "error.h"
+#include "socket.h"
+
+namespace mcast {
+namespace bpf {
+
+// A classic BPF program, as understood by SO_ATTACH_FILTER and friends.
+using Program = std::vector<struct sock_filter>;
+
+inline struct sock_filter stmt(uint16_t code, uint32_t k) noexcept {
+    return BPF_STMT(code, k);
+}
+
+inline struct sock_filter
+jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) noexcept {
+    return BPF_JUMP(code, k, jt, jf);
+}
+
+constexpr uint32_t kAccept{0x40000};  // "up to 256 KB of the packet"
+constexpr uint32_t kDrop{0};
+
+inline struct sock_fprog as_fprog(const Program& prog) noexcept {
+    return {
+        static_cast<unsigned short>(prog.size()),
+        const_cast<struct sock_filter*>(prog.data()),
+    };
+}
+
+inline error::Error attach(socket::Socket& s, const Program& prog) {
+    return socket::set(s, SOL_SOCKET, SO_ATTACH_FILTER, as_fprog(prog));
+}
+
+// Accept only packets whose receive processing ran on a CPU that maps,
+// modulo `count`, to `index`. Multicast is copied to every socket bound
+// to the port (SO_REUSEPORT balancing applies to unicast only), so this
+// is what splits a group's traffic between per-CPU sockets.
+inline Program cpu_steering(unsigned index, unsigned count) {
+    return {
+        stmt(BPF_LD | BPF_W | BPF_ABS,
+             static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)),
+        stmt(BPF_ALU | BPF_MOD | BPF_K, count),
+        jump(BPF_JMP | BPF_JEQ | BPF_K, index, 0, 1),
+        stmt(BPF_RET | BPF_K, kAccept),
+        stmt(BPF_RET | BPF_K, kDrop),
+    };
+}
+
+// Accept what both first and second accept, running second only on what
+// first accepts. Both may return only constants.
+inline Program both(const Program& first, const Program& second) {
+    Program prog{first};
+    for (size_t i = 0; i < prog.size(); i++) {
+        if (prog[i].code == (BPF_RET | BPF_K) && prog[i].k != kDrop) {
+            prog[i] = stmt(BPF_JMP | BPF_JA,
+                           static_cast<uint32_t>(prog.size() - i - 1));
+        }
+    }
+    prog.insert(prog.end(), second.begin(), second.end());
+    return prog;
+}
+
+}  // namespace bpf
+}  // namespace mcast
+
+#endif  // __linux__
+
+#endif  // MCAST_BPF_H
@@ -14,104 +14,191 @@ LICENSE_END */
 #define MCAST_DESCRIBE_H
 
 
-#include <cctype>
+#include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <cstdio>
-#include <iomanip>
-#include <sstream>
+#include <ctime>
 #include <string>
+#include <vector>
 
+#include "dns.h"
 #include "error.h"
+#include "hexdump.h"
+#include "names.h"
 #include "socket.h"
 
 namespace mcast {
 
 namespace {
 
-std::string get_current_time_description() {
-    std::stringstream str{};
-
+struct timespec get_current_time() {
     const auto now{std::chrono::system_clock::now()};
-    const auto epoch_us{std::chrono::duration_cast<std::chrono::microseconds>(
+    const auto epoch_ns{std::chrono::duration_cast<std::chrono::nanoseconds>(
             now.time_since_epoch()).count()};
-    const time_t epoch_s{epoch_us / 1'000'000};
-    str << "@" << epoch_s << "." << (epoch_us % 1'000'000);
+    return {static_cast<time_t>(epoch_ns / 1'000'000'000),
+            static_cast<long>(epoch_ns % 1'000'000'000)};
+}
+
+template<typename Int>
+void append_int(std::string& out, Int value) {
+    char buf[24];
+    const auto res{std::to_chars(buf, buf + sizeof(buf), value)};
+    out.append(buf, res.ptr);
+}
 
-    const auto cal_local_s{*(std::localtime(&epoch_s))};
-    str << " " << std::put_time(&cal_local_s, "%Y-%m-%d %H:%M:%S")
-        << "." << (epoch_us % 1'000'000);
+// The calendar part of a timestamp only changes once a second, so it is
+// formatted once per second (per thread); only the microseconds are
+// rendered for every datagram.
+void append_time_description(std::string& out, const struct timespec& ts) {
+    thread_local time_t cached_s{-1};
+    thread_local std::string cached_date{};
+
+    if (ts.tv_sec != cached_s) {
+        struct tm cal_local_s{};
+        ::localtime_r(&ts.tv_sec, &cal_local_s);
+        char buf[32]{};
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &cal_local_s);
+        cached_s = ts.tv_sec;
+        cached_date = buf;
+    }
 
-    return str.str();
+    const long us{ts.tv_nsec / 1000};
+    out.append("@");
+    append_int(out, ts.tv_sec);
+    out.append(".");
+    append_int(out, us);
+    out.append(" ").append(cached_date).append(".");
+    append_int(out, us);
 }
 
+inline bool is_dns_port(in_port_t port) noexcept {
+    return port == 53 || port == 5353;
 }
 
-std::string describe(const socket::Msg& msg, ssize_t rcvd) {
-    const std::string indent_short{"  "};
-    const std::string indent_long{"    "};
+// DNS and mDNS answers come from the well-known ports; queries go to
+// them, often from an ephemeral port (mDNS one-shot and legacy unicast
+// queries, RFC 6762 5.1).
+inline bool is_dns(const struct sockaddr_storage& from,
+                   in_port_t to_port) noexcept {
+    in_port_t from_port{0};
+    if (const auto* sin{socket::sockaddr_in_ptr(from)}) {
+        from_port = ntohs(sin->sin_port);
+    } else if (const auto* sin6{socket::sockaddr_in6_ptr(from)}) {
+        from_port = ntohs(sin6->sin6_port);
+    }
+    return is_dns_port(from_port) || is_dns_port(to_port);
+}
+
+}
 
+// A range of the payload to point out, and why.
+struct Highlight {
+    size_t offset{0};
+    size_t len{0};
+    const std::string* label{nullptr};
+};
+
+// Describe one datagram of `rcvd` bytes at `data`, received from `from`
+// with the given ancillary data, into `out` (replacing its contents).
+// Reusing `out` across calls keeps the hot path free of allocations.
+// Any highlights are marked beneath the hex dump and listed after it.
+// DNS messages, to or from to_port (host order, 0 if unknown), are
+// summarized as well.
+void describe_into(std::string& out,
+                   const struct sockaddr_storage& from,
+                   const socket::AuxiliaryData& aux,
+                   const uint8_t* data, ssize_t rcvd,
+                   const std::vector<Highlight>& highlights = {},
+                   in_port_t to_port = 0) {
+    const char* const indent_short{"  "};
+
+    out.clear();
     if (rcvd < 0) {
-        return "error (see POSIX errno message)";
+        out.append("error (see POSIX errno message)");
+        return;
     }
 
-    std::stringstream str{};
-
-    str << get_current_time_description();
-    str << "\nreceived " << rcvd
-        << " bytes from " << socket::to_string(msg.ss);
+    // Prefer the kernel's arrival time over when we got around to it.
+    append_time_description(out, socket::has_rx_time(aux)
+                                         ? socket::get_rx_time(aux)
+                                         : get_current_time());
+    out.append("\nreceived ");
+    append_int(out, rcvd);
+    out.append(" bytes from ");
+    names::append_address(out, from);
 
-    auto aux{socket::parse_aux(msg)};
     if (socket::has_hoplimit(aux)) {
-        str << "\n" << indent_short << "hops: " << socket::get_hoplimit(aux);
+        out.append("\n").append(indent_short).append("hops: ");
+        append_int(out, socket::get_hoplimit(aux));
     }
     if (socket::has_dscp(aux)) {
-        str << "\n" << indent_short << "dscp: " << socket::get_dscp(aux);
+        out.append("\n").append(indent_short).append("dscp: ");
+        append_int(out, socket::get_dscp(aux));
+    }
+    if (socket::has_hw_time(aux)) {
+        const auto ts{socket::get_hw_time(aux)};
+        char ns[10]{};
+        std::snprintf(ns, sizeof(ns), "%09ld", ts.tv_nsec);
+        out.append("\n").append(indent_short).append("nic time: ");
+        append_int(out, ts.tv_sec);
+        out.append(".").append(ns);
     }
     if (socket::has_pktinfo(aux)) {
         const unsigned ifindex{socket::get_pktinfo_interface(aux)};
-        str << "\n" << indent_short
-                    << "intf: " << socket::if_index2name(ifindex)
-                    << " (" << ifindex << ")";
+        out.append("\n").append(indent_short).append("intf: ");
+        names::append_interface(out, ifindex);
+        out.append(" (");
+        append_int(out, ifindex);
+        out.append(")");
     }
 
-    const int bytes_per_line{16};
-    char buf[3]{};
-    for (int i = 0; i < rcvd; i += bytes_per_line) {
-        if (i == 0) str << "\n" << indent_short << "data:";
-        str << "\n";
-
-        // Print bytes as lowercase hexadecimal.
-        str << indent_long;
-        for (int j = 0; j < bytes_per_line; j++) {
-            if (j % 2 == 0) str << " ";
-            if (j % 8 == 0) str << " ";
-            if (i + j < rcvd) {
-                std::snprintf(buf, 3, "%02x", msg.pckt[i + j]);
-            } else {
-                buf[0] = ' ';
-                buf[1] = ' ';
-            }
-            buf[2] = '\0';
-            str << buf;
+    if (rcvd > 0 && is_dns(from, to_port)) {
+        dns::Message msg;
+        if (error::ok(dns::parse(data, static_cast<size_t>(rcvd), msg))) {
+            dns::append_summary(out, msg, indent_short);
         }
+    }
 
-        // Print any bytes that look like printable characters.
-        str << indent_long;
-        for (int j = 0; j < bytes_per_line && (i + j < rcvd); j++) {
-            if (j % 2 == 0) str << " ";
-            if (j % 8 == 0) str << " ";
-            if (std::isgraph(msg.pckt[i + j]) != 0) {
-                std::snprintf(buf, 2, "%c", msg.pckt[i + j]);
-            } else {
-                buf[0] = '.';
+    if (rcvd > 0 && highlights.empty()) {
+        out.append("\n").append(indent_short).append("data:");
+        hexdump::append(out, data, static_cast<size_t>(rcvd));
+    } else if (rcvd > 0) {
+        thread_local std::vector<uint8_t> marks{};
+        const size_t len{static_cast<size_t>(rcvd)};
+        marks.assign(len, 0);
+        for (const auto& h : highlights) {
+            for (size_t i = h.offset; i < std::min(h.offset + h.len, len); i++) {
+                marks[i] = 1;
             }
-            buf[1] = '\0';
-            str << buf;
+        }
+        out.append("\n").append(indent_short).append("data:");
+        hexdump::append_marked(out, data, len, marks.data());
+        for (const auto& h : highlights) {
+            out.append("\n").append(indent_short).append("match: ");
+            if (h.label != nullptr) out.append(*h.label);
+            out.append(" at ");
+            append_int(out, h.offset);
         }
     }
 
-    str << "\n";
-    return str.str();
+    out.append("\n");
+}
+
+std::string describe(const struct sockaddr_storage& from,
+                     const socket::AuxiliaryData& aux,
+                     const uint8_t* data, ssize_t rcvd) {
+    std::string str{};
+    describe_into(str, from, aux, data, rcvd);
+    return str;
+}
+
+template<size_t Size>
+std::string describe(const socket::BasicMsg<Size>& msg, ssize_t rcvd) {
+    if (rcvd < 0) {
+        return "error (see POSIX errno message)";
+    }
+    return describe(msg.ss, socket::parse_aux(msg), msg.pckt, rcvd);
 }
 
 }  // namespace mcast
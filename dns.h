@@ -0,0 +1,396 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_DNS_H
+#define MCAST_DNS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <charconv>
+#include <string>
+
+#include "error.h"
+
+namespace mcast {
+namespace dns {
+
+// DNS (and mDNS) messages, parsed in place: a Message only records where
+// things are in the datagram, which must outlive it, and parsing never
+// allocates. Everything parse() accepts has been bounds-checked, names
+// included, so rendering can follow offsets without further doubt.
+constexpr size_t kHeaderSize{12};
+constexpr size_t kMaxRecords{32};
+constexpr size_t kMaxNameLength{255};
+constexpr unsigned kMaxPointers{32};  // compression pointers per name
+
+enum Type : uint16_t {
+    A = 1,
+    NS = 2,
+    CNAME = 5,
+    SOA = 6,
+    PTR = 12,
+    HINFO = 13,
+    TXT = 16,
+    AAAA = 28,
+    SRV = 33,
+    OPT = 41,
+    NSEC = 47,
+    ANY = 255,
+};
+
+enum class Section : uint8_t {
+    QUESTION,
+    ANSWER,
+    AUTHORITY,
+    ADDITIONAL,
+};
+
+struct Record {
+    Section section{Section::QUESTION};
+    uint16_t name{0};  // offset of the owner name
+    uint16_t type{0};
+    // The top bit is mDNS's unicast-response bit in a question, and its
+    // cache-flush bit in a record.
+    uint16_t klass{0};
+    uint32_t ttl{0};
+    uint16_t rdata{0};  // offset
+    uint16_t rdlength{0};
+};
+
+struct Message {
+    const uint8_t* data{nullptr};
+    size_t len{0};
+    uint16_t id{0};
+    uint16_t flags{0};
+    uint16_t counts[4]{};  // per Section, as the header says
+    Record records[kMaxRecords]{};
+    size_t count{0};  // parsed: at most kMaxRecords
+};
+
+namespace {
+
+inline uint16_t be16(const uint8_t* p) noexcept {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint32_t be32(const uint8_t* p) noexcept {
+    return (static_cast<uint32_t>(p[0]) << 24) |
+           (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// Check the name at off, following compression pointers, and move off
+// past it: past its first pointer, if it has one. Pointers may only lead
+// backwards, and only so many times, so no name loops.
+inline bool walk_name(const uint8_t* data, size_t len, size_t& off) noexcept {
+    size_t pos{off};
+    size_t total{1};
+    unsigned pointers{0};
+    bool jumped{false};
+    while (pos < len) {
+        const uint8_t l{data[pos]};
+        if ((l & 0xc0) == 0xc0) {
+            if (pos + 1 >= len || ++pointers > kMaxPointers) return false;
+            const size_t target{(static_cast<size_t>(l & 0x3f) << 8) |
+                                data[pos + 1]};
+            if (target >= pos) return false;
+            if (not jumped) off = pos + 2;
+            jumped = true;
+            pos = target;
+            continue;
+        }
+        if ((l & 0xc0) != 0) return false;  // obsolete label types
+        if (l == 0) {
+            if (not jumped) off = pos + 1;
+            return true;
+        }
+        total += 1 + l;
+        if (total > kMaxNameLength || pos + 1 + l > len) return false;
+        pos += 1 + l;
+    }
+    return false;
+}
+
+// Check that a name in rdata ends within it.
+inline bool rdata_name(const Message& m, size_t off, size_t end) noexcept {
+    return walk_name(m.data, m.len, off) && off <= end;
+}
+
+inline bool check_rdata(const Message& m, const Record& r) noexcept {
+    const size_t off{r.rdata};
+    const size_t end{off + r.rdlength};
+    switch (r.type) {
+        case A: return r.rdlength == 4;
+        case AAAA: return r.rdlength == 16;
+        case NS:
+        case CNAME:
+        case PTR:
+        case NSEC:
+            return rdata_name(m, off, end);
+        case SRV:
+            return r.rdlength >= 7 && rdata_name(m, off + 6, end);
+        default:
+            return true;
+    }
+}
+
+}  // namespace
+
+// Parse the message in len bytes at data into m. Records beyond
+// kMaxRecords are left unparsed; anything malformed up to there makes
+// the whole message EBADMSG.
+inline error::Error parse(const uint8_t* data, size_t len, Message& m) {
+    m.data = data;
+    m.len = len;
+    m.count = 0;
+    if (len < kHeaderSize || len > 0xffff) return error::Error{EBADMSG};
+    m.id = be16(data);
+    m.flags = be16(data + 2);
+    for (size_t s = 0; s < 4; s++) {
+        m.counts[s] = be16(data + 4 + 2 * s);
+    }
+
+    size_t off{kHeaderSize};
+    for (size_t s = 0; s < 4; s++) {
+        for (size_t n = 0; n < m.counts[s]; n++) {
+            if (m.count == kMaxRecords) return error::success();
+            Record& r{m.records[m.count]};
+            r = Record{static_cast<Section>(s), static_cast<uint16_t>(off)};
+            if (not walk_name(data, len, off)) return error::Error{EBADMSG};
+
+            if (r.section == Section::QUESTION) {
+                if (off + 4 > len) return error::Error{EBADMSG};
+                r.type = be16(data + off);
+                r.klass = be16(data + off + 2);
+                off += 4;
+            } else {
+                if (off + 10 > len) return error::Error{EBADMSG};
+                r.type = be16(data + off);
+                r.klass = be16(data + off + 2);
+                r.ttl = be32(data + off + 4);
+                r.rdlength = be16(data + off + 8);
+                r.rdata = static_cast<uint16_t>(off + 10);
+                off += 10;
+                if (off + r.rdlength > len || not check_rdata(m, r)) {
+                    return error::Error{EBADMSG};
+                }
+                off += r.rdlength;
+            }
+            m.count++;
+        }
+    }
+    return error::success();
+}
+
+inline size_t total_records(const Message& m) noexcept {
+    return static_cast<size_t>(m.counts[0]) + m.counts[1] + m.counts[2] +
+           m.counts[3];
+}
+
+inline const char* type_name(uint16_t type) noexcept {
+    switch (type) {
+        case A: return "A";
+        case NS: return "NS";
+        case CNAME: return "CNAME";
+        case SOA: return "SOA";
+        case PTR: return "PTR";
+        case HINFO: return "HINFO";
+        case TXT: return "TXT";
+        case AAAA: return "AAAA";
+        case SRV: return "SRV";
+        case OPT: return "OPT";
+        case NSEC: return "NSEC";
+        case ANY: return "ANY";
+        default: return nullptr;
+    }
+}
+
+namespace {
+
+template<typename Int>
+inline void append_number(std::string& out, Int value) {
+    char buf[24];
+    const auto res{std::to_chars(buf, buf + sizeof(buf), value)};
+    out.append(buf, res.ptr);
+}
+
+// Bytes of a label or character string, with anything unprintable, and
+// the separators, escaped as \DDD.
+inline void append_escaped(std::string& out, const uint8_t* p, size_t n,
+                           char separator) {
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t c{p[i]};
+        if (c > 0x20 && c < 0x7f && c != '\\' && c != separator) {
+            out.push_back(static_cast<char>(c));
+            continue;
+        }
+        const char esc[4]{'\\', static_cast<char>('0' + c / 100),
+                          static_cast<char>('0' + c / 10 % 10),
+                          static_cast<char>('0' + c % 10)};
+        out.append(esc, sizeof(esc));
+    }
+}
+
+}  // namespace
+
+// The name at off, which parse() has checked, in dotted form.
+inline void append_name(std::string& out, const Message& m, size_t off) {
+    bool empty{true};
+    unsigned pointers{0};
+    while (off < m.len) {
+        const uint8_t l{m.data[off]};
+        if ((l & 0xc0) == 0xc0) {
+            if (off + 1 >= m.len || ++pointers > kMaxPointers) break;
+            off = (static_cast<size_t>(l & 0x3f) << 8) | m.data[off + 1];
+            continue;
+        }
+        if (l == 0 || off + 1 + l > m.len) break;
+        if (not empty) out.push_back('.');
+        append_escaped(out, m.data + off + 1, l, '.');
+        empty = false;
+        off += 1 + l;
+    }
+    if (empty) out.push_back('.');
+}
+
+namespace {
+
+// Length-prefixed strings, quoted, as in TXT and HINFO; at most max of
+// them.
+inline void append_strings(std::string& out, const uint8_t* p, size_t n,
+                           size_t max) {
+    size_t shown{0};
+    size_t i{0};
+    while (i < n) {
+        const size_t l{p[i]};
+        if (i + 1 + l > n) break;
+        if (shown == max) {
+            out.append(" ...");
+            return;
+        }
+        out.append(shown == 0 ? "\"" : " \"");
+        append_escaped(out, p + i + 1, l, '"');
+        out.push_back('"');
+        shown++;
+        i += 1 + l;
+    }
+}
+
+inline void append_rdata(std::string& out, const Message& m, const Record& r) {
+    const uint8_t* p{m.data + r.rdata};
+    switch (r.type) {
+        case A:
+        case AAAA: {
+            char buf[INET6_ADDRSTRLEN]{};
+            if (::inet_ntop((r.type == A) ? AF_INET : AF_INET6, p, buf,
+                            sizeof(buf)) != nullptr) {
+                out.append(buf);
+            }
+            return;
+        }
+        case NS:
+        case CNAME:
+        case PTR:
+        case NSEC:  // just the next name, not the type bitmap
+            append_name(out, m, r.rdata);
+            return;
+        case SRV:
+            append_number(out, be16(p));
+            out.push_back(' ');
+            append_number(out, be16(p + 2));
+            out.push_back(' ');
+            append_number(out, be16(p + 4));
+            out.push_back(' ');
+            append_name(out, m, r.rdata + 6u);
+            return;
+        case TXT:
+            append_strings(out, p, r.rdlength, 8);
+            return;
+        case HINFO:
+            append_strings(out, p, r.rdlength, 2);
+            return;
+        default:
+            append_number(out, r.rdlength);
+            out.append(" bytes");
+            return;
+    }
+}
+
+}  // namespace
+
+// A line about the message, then one line per parsed record, each line
+// starting with a newline and the given indent.
+inline void append_summary(std::string& out, const Message& m,
+                           const char* indent) {
+    out.append("\n").append(indent).append("dns: ");
+    out.append((m.flags & 0x8000) ? "response" : "query");
+    out.append(" id ");
+    append_number(out, m.id);
+    if (m.flags & 0x0400) out.append(" aa");
+    if (m.flags & 0x0200) out.append(" tc");
+    if (m.flags & 0x0100) out.append(" rd");
+    if (m.flags & 0x0080) out.append(" ra");
+    if ((m.flags & 0x000f) != 0) {
+        out.append(" rcode ");
+        append_number(out, m.flags & 0x000f);
+    }
+    static const char* const kSections[]{"q", "an", "ns", "ar"};
+    for (size_t s = 0; s < 4; s++) {
+        out.append(s == 0 ? ", " : " ");
+        append_number(out, m.counts[s]);
+        out.append(kSections[s]);
+    }
+
+    for (size_t i = 0; i < m.count; i++) {
+        const Record& r{m.records[i]};
+        out.append("\n").append(indent).append("  ");
+        out.append(kSections[static_cast<size_t>(r.section)]);
+        out.push_back(' ');
+        append_name(out, m, r.name);
+        out.push_back(' ');
+        if (const char* name{type_name(r.type)}) {
+            out.append(name);
+        } else {
+            out.append("TYPE");
+            append_number(out, r.type);
+        }
+        if (r.section == Section::QUESTION) {
+            if (r.klass & 0x8000) out.append(" QU");
+            continue;
+        }
+        if (r.type == OPT) {
+            out.append(" udp ");  // the class is the sender's UDP size
+            append_number(out, r.klass);
+            continue;
+        }
+        out.push_back(' ');
+        append_rdata(out, m, r);
+        out.append(" ttl ");
+        append_number(out, r.ttl);
+        if (r.klass & 0x8000) out.append(" flush");
+    }
+    if (m.count < total_records(m)) {
+        out.append("\n").append(indent).append("  ... ");
+        append_number(out, total_records(m) - m.count);
+        out.append(" more");
+    }
+}
+
+}  // namespace dns
+}  // namespace mcast
+
+#endif  // MCAST_DNS_H
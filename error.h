@@ -42,12 +42,12 @@ inline void clear() noexcept {
     errno = 0;
 }
 
-inline Error&& current() noexcept {
-    return std::move(Error{errno});
+inline Error current() noexcept {
+    return Error{errno};
 }
 
-inline Error&& from(int rval) noexcept {
-    return std::move(Error{(rval == 0) ? 0 : errno});
+inline Error from(int rval) noexcept {
+    return Error{(rval == 0) ? 0 : errno};
 }
 
 inline const char* to_string(const Error& e) {
@@ -55,6 +55,7 @@ inline const char* to_string(const Error& e) {
         case Category::ERRNO: return std::strerror(e.num);
         case Category::ADDRINFO: return ::gai_strerror(e.num);
     }
+    return "unknown error category";
 }
 
 }  // namespace error
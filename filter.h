@@ -0,0 +1,423 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_FILTER_H
+#define MCAST_FILTER_H
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bpf.h"
+#include "error.h"
+#include "socket.h"
+
+namespace mcast {
+namespace filter {
+
+// Datagram filter expressions, compiled to classic BPF so that whatever
+// they reject is dropped by the kernel before it is ever queued to the
+// socket:
+//
+//   expr    := conj ('or' conj)*
+//   conj    := unary ('and' unary)*
+//   unary   := 'not' unary | '(' expr ')' | test
+//   test    := 'src' ADDR['/'BITS]   source address or prefix
+//            | 'sport' PORT          source port
+//            | 'len' N['-'[M]]       payload length; N- for N or more
+//            | 'at' OFF HEX          payload bytes at OFF, e.g. at 0 6d637374
+//
+// A UDP socket's filter sees the datagram from its UDP header on; the IP
+// header is reached through SKF_NET_OFF.
+
+namespace {
+
+constexpr uint32_t kUdpHeader{8};
+
+// One load, maybe masked, and one comparison: the test passes when the
+// comparison holds, or, if negate, when it does not.
+struct Step {
+    uint16_t load{0};  // BPF_LD | size | mode
+    uint32_t offset{0};
+    uint32_t mask{0};  // 0: unmasked
+    uint16_t op{BPF_JEQ};
+    uint32_t value{0};
+    bool negate{false};
+};
+
+struct Node {
+    enum class Kind { TEST, NOT, AND, OR };
+    Kind kind{Kind::TEST};
+    std::vector<Step> steps{};  // Kind::TEST; none always passes
+    std::vector<Node> kids{};
+};
+
+struct Parser {
+    std::vector<std::string> tokens{};
+    size_t next{0};
+    int family{AF_UNSPEC};
+    std::string complaint{};
+
+    bool done() const { return next >= tokens.size(); }
+    const std::string& peek() const {
+        static const std::string none{};
+        return done() ? none : tokens[next];
+    }
+    bool fail(const std::string& why) {
+        if (complaint.empty()) complaint = why;
+        return false;
+    }
+};
+
+inline std::vector<std::string> tokenize(const std::string& text) {
+    std::vector<std::string> tokens{};
+    std::string word{};
+    for (const char c : text) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '(' || c == ')') {
+            if (not word.empty()) tokens.push_back(word);
+            word.clear();
+            if (c == '(' || c == ')') tokens.emplace_back(1, c);
+            continue;
+        }
+        word.push_back(c);
+    }
+    if (not word.empty()) tokens.push_back(word);
+    return tokens;
+}
+
+inline bool parse_number(const std::string& text, uint32_t max,
+                         uint32_t& value) {
+    if (text.empty() || text[0] == '-') return false;
+    char* end{nullptr};
+    errno = 0;
+    const unsigned long n{std::strtoul(text.c_str(), &end, 0)};
+    if (errno != 0 || *end != '\0' || n > max) return false;
+    value = static_cast<uint32_t>(n);
+    return true;
+}
+
+inline bool parse_hex(std::string text, std::vector<uint8_t>& bytes) {
+    if (text.rfind("0x", 0) == 0 || text.rfind("0X", 0) == 0) {
+        text.erase(0, 2);
+    }
+    if (text.empty() || text.size() % 2 != 0) return false;
+    for (size_t i = 0; i < text.size(); i += 2) {
+        const std::string pair{text.substr(i, 2)};
+        if (pair.find_first_not_of("0123456789abcdefABCDEF") !=
+            std::string::npos) {
+            return false;
+        }
+        bytes.push_back(static_cast<uint8_t>(
+                std::strtoul(pair.c_str(), nullptr, 16)));
+    }
+    return true;
+}
+
+// The top `bits` bits of a 32-bit word.
+inline uint32_t prefix_mask(unsigned bits) noexcept {
+    return (bits == 0) ? 0 : ~uint32_t{0} << (32 - bits);
+}
+
+inline bool parse_src(Parser& p, Node& test) {
+    const std::string arg{p.peek()};
+    p.next++;
+    const size_t slash{arg.find('/')};
+    uint32_t bits{128};
+    if (slash != std::string::npos &&
+        not parse_number(arg.substr(slash + 1), 128, bits)) {
+        return p.fail("bad prefix length in 'src " + arg + "'");
+    }
+
+    const auto ss_or{socket::from_string(arg.substr(0, slash).c_str())};
+    if (not ok(ss_or)) {
+        return p.fail("bad address in 'src " + arg + "'");
+    }
+    const auto& ss{get_valueref_unsafe(ss_or)};
+    if (ss.ss_family != p.family) {
+        return p.fail("'src " + arg + "' is not of the group's family");
+    }
+
+    uint8_t addr[16]{};
+    uint32_t source_offset{0};
+    if (const auto* sin{socket::sockaddr_in_ptr(ss)}) {
+        memcpy(addr, &(sin->sin_addr), 4);
+        source_offset = 12;  // in the IPv4 header
+        if (slash == std::string::npos) bits = 32;
+        if (bits > 32) return p.fail("prefix too long in 'src " + arg + "'");
+    } else if (const auto* sin6{socket::sockaddr_in6_ptr(ss)}) {
+        memcpy(addr, &(sin6->sin6_addr), 16);
+        source_offset = 8;  // in the IPv6 header
+    }
+
+    for (unsigned word = 0; word * 32 < bits; word++) {
+        uint32_t value{0};
+        memcpy(&value, addr + 4 * word, 4);
+        const uint32_t mask{prefix_mask(std::min(bits - word * 32, 32u))};
+        test.steps.push_back({
+            BPF_LD | BPF_W | BPF_ABS,
+            static_cast<uint32_t>(SKF_NET_OFF) + source_offset + 4 * word,
+            (mask == ~uint32_t{0}) ? 0 : mask,
+            BPF_JEQ,
+            ntohl(value) & mask,
+        });
+    }
+    return true;
+}
+
+inline bool parse_len(Parser& p, Node& test) {
+    const std::string arg{p.peek()};
+    p.next++;
+    const size_t dash{arg.find('-')};
+    uint32_t min{0};
+    uint32_t max{0xffff};
+    bool valid{parse_number(arg.substr(0, dash), 0xffff, min)};
+    if (dash == std::string::npos) {
+        max = min;
+    } else if (dash + 1 < arg.size()) {
+        valid = valid && parse_number(arg.substr(dash + 1), 0xffff, max);
+    }
+    if (not valid || max < min) {
+        return p.fail("bad range in 'len " + arg + "'");
+    }
+    // The packet length includes the UDP header.
+    test.steps.push_back({BPF_LD | BPF_W | BPF_LEN, 0, 0, BPF_JGE,
+                          kUdpHeader + min});
+    test.steps.push_back({BPF_LD | BPF_W | BPF_LEN, 0, 0, BPF_JGT,
+                          kUdpHeader + max, true});
+    return true;
+}
+
+inline bool parse_at(Parser& p, Node& test) {
+    uint32_t offset{0};
+    std::vector<uint8_t> bytes{};
+    if (not parse_number(p.peek(), 0xffff, offset)) {
+        return p.fail("bad offset in 'at " + p.peek() + "'");
+    }
+    p.next++;
+    if (not parse_hex(p.peek(), bytes)) {
+        return p.fail("bad hex bytes in 'at ... " + p.peek() + "'");
+    }
+    p.next++;
+
+    const uint32_t start{kUdpHeader + offset};
+    // A load past the end would end the program with a drop, even under
+    // 'not': check the length first.
+    test.steps.push_back({BPF_LD | BPF_W | BPF_LEN, 0, 0, BPF_JGE,
+                          start + static_cast<uint32_t>(bytes.size())});
+    for (size_t i = 0; i < bytes.size();) {
+        const size_t left{bytes.size() - i};
+        const size_t n{(left >= 4) ? 4u : (left >= 2) ? 2u : 1u};
+        uint32_t value{0};
+        for (size_t j = 0; j < n; j++) value = (value << 8) | bytes[i + j];
+        const uint16_t size{static_cast<uint16_t>(
+                (n == 4) ? BPF_W : (n == 2) ? BPF_H : BPF_B)};
+        test.steps.push_back({static_cast<uint16_t>(BPF_LD | size | BPF_ABS),
+                              start + static_cast<uint32_t>(i), 0, BPF_JEQ,
+                              value});
+        i += n;
+    }
+    return true;
+}
+
+inline bool parse_expr(Parser& p, Node& node);
+
+inline bool parse_unary(Parser& p, Node& node) {
+    if (p.done()) return p.fail("unexpected end of filter");
+    const std::string word{p.peek()};
+    p.next++;
+    if (word == "not") {
+        node.kind = Node::Kind::NOT;
+        node.kids.resize(1);
+        return parse_unary(p, node.kids[0]);
+    }
+    if (word == "(") {
+        if (not parse_expr(p, node)) return false;
+        if (p.peek() != ")") return p.fail("missing ')'");
+        p.next++;
+        return true;
+    }
+
+    node.kind = Node::Kind::TEST;
+    if (word != "src" && word != "sport" && word != "len" && word != "at") {
+        return p.fail("unknown test '" + word + "'");
+    }
+    if (p.done()) return p.fail("'" + word + "' needs an argument");
+    if (word == "src") return parse_src(p, node);
+    if (word == "len") return parse_len(p, node);
+    if (word == "at") return parse_at(p, node);
+
+    uint32_t port{0};
+    if (not parse_number(p.peek(), 0xffff, port)) {
+        return p.fail("bad port in 'sport " + p.peek() + "'");
+    }
+    p.next++;
+    node.steps.push_back({BPF_LD | BPF_H | BPF_ABS, 0, 0, BPF_JEQ, port});
+    return true;
+}
+
+// conj, or expr: a run of `below` joined by `word`.
+template<typename Below>
+inline bool parse_joined(Parser& p, Node& node, const char* word,
+                         Node::Kind kind, Below&& below) {
+    Node first{};
+    if (not below(p, first)) return false;
+    if (p.peek() != word) {
+        node = std::move(first);
+        return true;
+    }
+    node = Node{kind};
+    node.kids.push_back(std::move(first));
+    while (p.peek() == word) {
+        p.next++;
+        node.kids.emplace_back();
+        if (not below(p, node.kids.back())) return false;
+    }
+    return true;
+}
+
+inline bool parse_conj(Parser& p, Node& node) {
+    return parse_joined(p, node, "and", Node::Kind::AND, parse_unary);
+}
+
+inline bool parse_expr(Parser& p, Node& node) {
+    return parse_joined(p, node, "or", Node::Kind::OR, parse_conj);
+}
+
+// Code with jumps to labels, resolved once every label is placed. All
+// labels are placed after the jumps to them: cBPF only jumps forward.
+struct Emitter {
+    struct Insn {
+        struct sock_filter insn{};
+        int jt{-1};  // label, or -1 for a fixed offset
+        int jf{-1};
+    };
+    std::vector<Insn> code{};
+    std::vector<size_t> labels{};
+
+    int label() {
+        labels.push_back(SIZE_MAX);
+        return static_cast<int>(labels.size() - 1);
+    }
+    void place(int l) { labels[l] = code.size(); }
+    void emit(struct sock_filter insn, int jt = -1, int jf = -1) {
+        code.push_back({insn, jt, jf});
+    }
+};
+
+inline void generate(Emitter& e, const Node& node, int pass, int fail) {
+    switch (node.kind) {
+        case Node::Kind::TEST: {
+            if (node.steps.empty()) {
+                e.emit(bpf::stmt(BPF_JMP | BPF_JA, 0), pass);
+                return;
+            }
+            for (size_t i = 0; i < node.steps.size(); i++) {
+                const auto& step{node.steps[i]};
+                e.emit(bpf::stmt(step.load, step.offset));
+                if (step.mask != 0) {
+                    e.emit(bpf::stmt(BPF_ALU | BPF_AND | BPF_K, step.mask));
+                }
+                int next{pass};
+                if (i + 1 < node.steps.size()) {
+                    next = e.label();
+                }
+                e.emit(bpf::jump(BPF_JMP | step.op | BPF_K, step.value, 0, 0),
+                       step.negate ? fail : next, step.negate ? next : fail);
+                if (next != pass) e.place(next);
+            }
+            return;
+        }
+        case Node::Kind::NOT:
+            generate(e, node.kids[0], fail, pass);
+            return;
+        case Node::Kind::AND:
+        case Node::Kind::OR: {
+            const bool conj{node.kind == Node::Kind::AND};
+            for (size_t i = 0; i + 1 < node.kids.size(); i++) {
+                const int next{e.label()};
+                generate(e, node.kids[i], conj ? next : pass,
+                         conj ? fail : next);
+                e.place(next);
+            }
+            generate(e, node.kids.back(), pass, fail);
+            return;
+        }
+    }
+}
+
+}  // namespace
+
+// Compile text into a program for a socket of the given family. On
+// EINVAL, complaint says what is wrong with the expression.
+inline ErrorOr<bpf::Program> compile(const std::string& text, int family,
+                                     std::string& complaint) {
+    Parser p{tokenize(text), 0, family};
+    Node root{};
+    if (not parse_expr(p, root) || not p.done()) {
+        complaint = p.complaint.empty()
+                ? "unexpected '" + p.peek() + "'" : p.complaint;
+        return error::Error{EINVAL};
+    }
+
+    Emitter e{};
+    const int accept{e.label()};
+    const int drop{e.label()};
+    generate(e, root, accept, drop);
+    e.place(accept);
+    e.emit(bpf::stmt(BPF_RET | BPF_K, bpf::kAccept));
+    e.place(drop);
+    e.emit(bpf::stmt(BPF_RET | BPF_K, bpf::kDrop));
+
+    if (e.code.size() > BPF_MAXINSNS) {
+        complaint = "filter too long";
+        return error::Error{E2BIG};
+    }
+    bpf::Program prog{};
+    const std::vector<size_t>& labels{e.labels};
+    for (size_t i = 0; i < e.code.size(); i++) {
+        auto insn{e.code[i].insn};
+        // Jumps are relative to the next instruction.
+        const auto offset = [&labels, i](int l) -> size_t {
+            return (l < 0) ? 0 : labels[static_cast<size_t>(l)] - (i + 1);
+        };
+        if (insn.code == (BPF_JMP | BPF_JA)) {
+            insn.k = static_cast<uint32_t>(offset(e.code[i].jt));
+        } else if (BPF_CLASS(insn.code) == BPF_JMP) {
+            const size_t jt{offset(e.code[i].jt)};
+            const size_t jf{offset(e.code[i].jf)};
+            if (jt > 0xff || jf > 0xff) {
+                complaint = "filter too long for its jumps";
+                return error::Error{E2BIG};
+            }
+            insn.jt = static_cast<uint8_t>(jt);
+            insn.jf = static_cast<uint8_t>(jf);
+        }
+        prog.push_back(insn);
+    }
+    return prog;
+}
+
+}  // namespace filter
+}  // namespace mcast
+
+#endif  // __linux__
+
+#endif  // MCAST_FILTER_H
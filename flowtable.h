@@ -0,0 +1,410 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_FLOWTABLE_H
+#define MCAST_FLOWTABLE_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pace.h"
+#include "probe.h"
+#include "socket.h"
+
+namespace mcast {
+namespace flowtable {
+
+// Per-source traffic statistics, keyed by (source address and port,
+// ingress interface, group), in an open-addressing hash table of
+// one-cache-line entries: a lookup touches one line in the common case,
+// and nothing is allocated per datagram.
+
+// Sources not heard from for this long are forgotten.
+constexpr uint32_t kMaxIdleMs{60'000};
+constexpr size_t kInitialSlots{1024};
+// Beyond this many sources, new ones are counted but not tracked.
+constexpr size_t kMaxSlots{size_t{1} << 20};
+
+struct alignas(64) Entry {
+    uint8_t addr[16]{};  // IPv4 in the first four bytes
+    uint32_t ifindex{0};
+    uint16_t port{0};    // network byte order
+    uint16_t group{0};   // index into Table::groups
+    uint8_t family{0};   // 0: free slot
+    uint8_t hoplimit{0};
+    uint8_t dscp{0};
+    uint8_t flags{0};
+    uint32_t first_ms{0};  // since Table::epoch_ns
+    uint32_t last_ms{0};
+    uint32_t lost{0};      // gaps in probe sequence numbers
+    uint64_t packets{0};
+    uint64_t bytes{0};
+    uint64_t max_seq{0};   // highest probe sequence number seen
+};
+static_assert(sizeof(Entry) == 64);
+
+constexpr uint8_t kHasSeq{0x01};
+
+struct Table {
+    Table() : slots(kInitialSlots) {}
+
+    std::vector<Entry> slots;  // a power of two
+    size_t used{0};
+    uint64_t untracked{0};  // datagrams from sources that did not fit
+    // Group addresses seen, usually just the one joined.
+    std::vector<std::array<uint8_t, 16>> groups{};
+    uint16_t last_group{0};
+};
+
+// One table per receiving thread, each behind a lock of its own that only
+// a report ever contends for.
+struct Shard {
+    std::mutex mtx{};
+    Table table{};
+};
+
+namespace {
+
+#ifdef CLOCK_MONOTONIC_COARSE  // not available on macOS
+constexpr clockid_t kClock{CLOCK_MONOTONIC_COARSE};
+#else
+constexpr clockid_t kClock{CLOCK_MONOTONIC};
+#endif
+
+}  // namespace
+
+struct Flows {
+    std::mutex mtx{};
+    std::vector<std::unique_ptr<Shard>> shards{};
+    // On the clock that now_ms() reads: the coarse clock lags the precise
+    // one, and an epoch ahead of it would make early times underflow.
+    uint64_t epoch_ns{pace::now_ns(kClock)};
+};
+
+namespace {
+
+inline uint32_t now_ms(const Flows& f) noexcept {
+    return static_cast<uint32_t>((pace::now_ns(kClock) - f.epoch_ns) /
+                                 1'000'000);
+}
+
+inline uint64_t load64(const uint8_t* p) noexcept {
+    uint64_t v{0};
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t hash(const Entry& e) noexcept {
+    uint64_t h{load64(e.addr) * 0x9e3779b97f4a7c15};
+    h ^= load64(e.addr + 8) + (h << 6) + (h >> 2);
+    h ^= ((static_cast<uint64_t>(e.ifindex) << 32) |
+          (static_cast<uint64_t>(e.port) << 16) |
+          (static_cast<uint64_t>(e.group) << 8) | e.family) *
+         0xc2b2ae3d27d4eb4f;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    return h;
+}
+
+inline bool same_key(const Entry& a, const Entry& b) noexcept {
+    return a.family == b.family && a.port == b.port &&
+           a.ifindex == b.ifindex && a.group == b.group &&
+           memcmp(a.addr, b.addr, sizeof(a.addr)) == 0;
+}
+
+inline uint16_t intern_group(Table& t, const uint8_t* addr) {
+    if (t.last_group < t.groups.size() &&
+        memcmp(t.groups[t.last_group].data(), addr, 16) == 0) {
+        return t.last_group;
+    }
+    for (size_t i = 0; i < t.groups.size(); i++) {
+        if (memcmp(t.groups[i].data(), addr, 16) == 0) {
+            t.last_group = static_cast<uint16_t>(i);
+            return t.last_group;
+        }
+    }
+    if (t.groups.size() > UINT16_MAX) return UINT16_MAX;
+    t.groups.emplace_back();
+    memcpy(t.groups.back().data(), addr, 16);
+    t.last_group = static_cast<uint16_t>(t.groups.size() - 1);
+    return t.last_group;
+}
+
+// Where key is, or the free slot where it would go.
+inline size_t probe_for(const Table& t, const Entry& key) noexcept {
+    const size_t mask{t.slots.size() - 1};
+    size_t i{static_cast<size_t>(hash(key)) & mask};
+    while (t.slots[i].family != 0 && not same_key(t.slots[i], key)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+inline void grow(Table& t) {
+    std::vector<Entry> old(t.slots.size() * 2);
+    old.swap(t.slots);
+    for (const auto& e : old) {
+        if (e.family != 0) t.slots[probe_for(t, e)] = e;
+    }
+}
+
+// Empty slot i, shifting back any entries that probed past it, so that
+// lookups never need tombstones.
+inline void erase(Table& t, size_t i) noexcept {
+    const size_t mask{t.slots.size() - 1};
+    size_t j{i};
+    while (true) {
+        j = (j + 1) & mask;
+        if (t.slots[j].family == 0) break;
+        const size_t home{static_cast<size_t>(hash(t.slots[j])) & mask};
+        // Leave j alone if its home lies cyclically in (i, j].
+        if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        t.slots[i] = t.slots[j];
+        i = j;
+    }
+    t.slots[i] = Entry{};
+    t.used--;
+}
+
+inline void update(Entry& e, const socket::AuxiliaryData& aux,
+                   const uint8_t* data, size_t len, uint32_t now) noexcept {
+    if (e.packets == 0) e.first_ms = now;
+    e.last_ms = now;
+    e.packets++;
+    e.bytes += len;
+    if (socket::has_hoplimit(aux)) {
+        e.hoplimit = static_cast<uint8_t>(socket::get_hoplimit(aux));
+    }
+    if (socket::has_dscp(aux)) {
+        e.dscp = static_cast<uint8_t>(socket::get_dscp(aux));
+    }
+
+    probe::Header h{};
+    if (not probe::decode(data, len, h)) return;
+    if (not (e.flags & kHasSeq)) {
+        e.flags |= kHasSeq;
+        e.max_seq = h.seq;
+    } else if (h.seq > e.max_seq) {
+        e.lost += static_cast<uint32_t>(
+                std::min<uint64_t>(h.seq - e.max_seq - 1, UINT32_MAX));
+        e.max_seq = h.seq;
+    } else if (h.seq == e.max_seq) {
+        // A duplicate of the latest: nothing was missing.
+    } else if (e.max_seq - h.seq >= probe::Flow::kWindow) {
+        e.max_seq = h.seq;  // the sender started over
+    } else if (e.lost > 0) {
+        // A late arrival fills a gap. Without room in the entry for a
+        // bitmap of what was seen, a duplicate of an older datagram looks
+        // the same; -a tells them apart.
+        e.lost--;
+    }
+}
+
+inline Shard& shard_for_this_thread(Flows& f) {
+    thread_local Flows* owner{nullptr};
+    thread_local Shard* mine{nullptr};
+    if (owner != &f) {
+        std::lock_guard<std::mutex> lock{f.mtx};
+        f.shards.push_back(std::make_unique<Shard>());
+        mine = f.shards.back().get();
+        owner = &f;
+    }
+    return *mine;
+}
+
+}  // namespace
+
+inline void record(Flows& f,
+                   const struct sockaddr_storage& from,
+                   const socket::AuxiliaryData& aux,
+                   const uint8_t* data, size_t len) {
+    Entry key{};
+    uint8_t group[16]{};
+    key.family = static_cast<uint8_t>(from.ss_family);
+    switch (from.ss_family) {
+        case AF_INET: {
+            const auto* sin{socket::sockaddr_in_ptr(from)};
+            memcpy(key.addr, &(sin->sin_addr), 4);
+            key.port = sin->sin_port;
+            break;
+        }
+        case AF_INET6: {
+            const auto* sin6{socket::sockaddr_in6_ptr(from)};
+            memcpy(key.addr, &(sin6->sin6_addr), 16);
+            key.port = sin6->sin6_port;
+            break;
+        }
+        default:
+            return;
+    }
+    if (const auto* pi{std::get_if<struct in_pktinfo>(&(aux.pktinfo))}) {
+        memcpy(group, &(pi->ipi_addr), 4);
+    } else if (const auto* pi6{
+            std::get_if<struct in6_pktinfo>(&(aux.pktinfo))}) {
+        memcpy(group, &(pi6->ipi6_addr), 16);
+    }
+    key.ifindex = socket::get_pktinfo_interface(aux);
+    const uint32_t now{now_ms(f)};
+
+    Shard& shard{shard_for_this_thread(f)};
+    std::lock_guard<std::mutex> lock{shard.mtx};
+    Table& t{shard.table};
+    key.group = intern_group(t, group);
+
+    size_t i{probe_for(t, key)};
+    if (t.slots[i].family == 0) {
+        // Keep the load factor at or below 3/4.
+        if (4 * (t.used + 1) > 3 * t.slots.size()) {
+            if (t.slots.size() >= kMaxSlots) {
+                t.untracked++;
+                return;
+            }
+            grow(t);
+            i = probe_for(t, key);
+        }
+        t.slots[i] = key;
+        t.used++;
+    }
+    update(t.slots[i], aux, data, len, now);
+}
+
+// Forget sources idle for longer than kMaxIdleMs.
+inline void expire(Flows& f) {
+    const uint32_t now{now_ms(f)};
+    std::lock_guard<std::mutex> lock{f.mtx};
+    for (auto& shard : f.shards) {
+        std::lock_guard<std::mutex> shard_lock{shard->mtx};
+        Table& t{shard->table};
+        for (size_t i = 0; i < t.slots.size();) {
+            const Entry& e{t.slots[i]};
+            if (e.family != 0 && now - e.last_ms > kMaxIdleMs) {
+                erase(t, i);  // may move another entry into slot i
+                continue;
+            }
+            i++;
+        }
+    }
+}
+
+namespace {
+
+inline std::string group_string(const Entry& e, const uint8_t* group) {
+    char buf[INET6_ADDRSTRLEN]{};
+    ::inet_ntop(e.family, group, buf, sizeof(buf));
+    return buf;
+}
+
+}  // namespace
+
+// The n busiest sources by datagram count, one per line. A source seen
+// by several receive threads is summed across them.
+inline std::string top(Flows& f, size_t n) {
+    Table merged{};
+    {
+        std::lock_guard<std::mutex> lock{f.mtx};
+        for (auto& shard : f.shards) {
+            std::lock_guard<std::mutex> shard_lock{shard->mtx};
+            const Table& t{shard->table};
+            merged.untracked += t.untracked;
+            for (const auto& e : t.slots) {
+                if (e.family == 0) continue;
+                // Group indices are per table.
+                Entry key{e};
+                key.group = intern_group(merged, t.groups[e.group].data());
+                const size_t i{probe_for(merged, key)};
+                Entry& m{merged.slots[i]};
+                if (m.family == 0) {
+                    m = key;
+                    if (4 * (++merged.used) > 3 * merged.slots.size()) {
+                        grow(merged);
+                    }
+                    continue;
+                }
+                m.packets += e.packets;
+                m.bytes += e.bytes;
+                m.lost += e.lost;
+                m.first_ms = std::min(m.first_ms, e.first_ms);
+                if (e.last_ms > m.last_ms) {
+                    m.last_ms = e.last_ms;
+                    m.hoplimit = e.hoplimit;
+                    m.dscp = e.dscp;
+                }
+            }
+        }
+    }
+
+    std::vector<const Entry*> busiest{};
+    for (const auto& e : merged.slots) {
+        if (e.family != 0) busiest.push_back(&e);
+    }
+    const size_t shown{std::min(n, busiest.size())};
+    std::partial_sort(busiest.begin(), busiest.begin() + shown, busiest.end(),
+                      [](const Entry* a, const Entry* b) {
+                          return a->packets > b->packets;
+                      });
+
+    const uint32_t now{now_ms(f)};
+    std::stringstream str{};
+    str << "top " << shown << " of " << busiest.size() << " sources";
+    if (merged.untracked > 0) {
+        str << " (" << merged.untracked
+            << " datagrams from untracked sources)";
+    }
+    str << ":\n";
+    for (size_t i = 0; i < shown; i++) {
+        const Entry& e{*busiest[i]};
+        struct sockaddr_storage ss{};
+        ss.ss_family = e.family;
+        if (auto* sin{socket::sockaddr_in_ptr(ss)}) {
+            memcpy(&(sin->sin_addr), e.addr, 4);
+            sin->sin_port = e.port;
+        } else if (auto* sin6{socket::sockaddr_in6_ptr(ss)}) {
+            memcpy(&(sin6->sin6_addr), e.addr, 16);
+            sin6->sin6_port = e.port;
+        }
+
+        str << "  " << socket::to_string(ss) << " > "
+            << group_string(e, merged.groups[e.group].data());
+        if (e.ifindex != 0) {
+            str << " (" << socket::if_index2name(e.ifindex) << ")";
+        }
+        str << ": " << e.packets << " pkts, " << e.bytes << " bytes, hops "
+            << static_cast<int>(e.hoplimit) << ", dscp "
+            << static_cast<int>(e.dscp);
+        if (e.flags & kHasSeq) {
+            str << ", lost " << e.lost;
+        }
+        str << ", active " << ((e.last_ms - e.first_ms) / 1000)
+            << " s, idle " << (now - e.last_ms) << " ms\n";
+    }
+    return str.str();
+}
+
+}  // namespace flowtable
+}  // namespace mcast
+
+#endif  // MCAST_FLOWTABLE_H
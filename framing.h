@@ -0,0 +1,246 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_FRAMING_H
+#define MCAST_FRAMING_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "error.h"
+
+namespace mcast {
+namespace framing {
+
+// How client input is cut into datagrams: one record each.
+enum class Mode {
+    LINE,    // newline-terminated; the newline is not sent
+    LENGTH,  // 2-byte big-endian length, then that many bytes
+    FIXED,   // every record the same size
+};
+
+struct Format {
+    Mode mode{Mode::LINE};
+    size_t fixed_size{0};  // Mode::FIXED only
+};
+
+// "line", "length" or "fixed:N"
+inline ErrorOr<Format> parse(const std::string& arg) {
+    if (arg == "line") return Format{Mode::LINE};
+    if (arg == "length") return Format{Mode::LENGTH};
+    if (arg.rfind("fixed:", 0) == 0) {
+        const long size{std::atol(arg.c_str() + 6)};
+        if (size > 0 && size <= 0xffff) {
+            return Format{Mode::FIXED, static_cast<size_t>(size)};
+        }
+    }
+    return error::Error{EINVAL};
+}
+
+// Where records come from. A regular file is mapped whole and records
+// point straight into the mapping; anything else (a pipe, a terminal) is
+// read() a megabyte at a time, and records point into that buffer.
+struct Input {
+    Input() = default;
+    Input(const Input&) = delete;
+    Input& operator=(const Input&) = delete;
+    ~Input() {
+        if (map != nullptr) ::munmap(const_cast<uint8_t*>(map), map_len);
+    }
+
+    int fd{-1};
+    const uint8_t* map{nullptr};
+    size_t map_len{0};
+
+    std::vector<uint8_t> buf{};
+    const uint8_t* data{nullptr};  // the mapping, or buf
+    size_t begin{0};  // first unconsumed byte
+    size_t end{0};    // one past the last valid byte
+    bool eof{false};
+    bool skipping{false};  // the rest of an overlong line
+
+    uint64_t oversize{0};  // records too big for a datagram, skipped
+    uint64_t truncated{0};  // bytes of an incomplete final record
+};
+
+constexpr size_t kReadSize{1 << 20};
+// No datagram can carry more than this.
+constexpr size_t kMaxRecord{0xffff};
+
+inline ErrorOr<std::unique_ptr<Input>> open(int fd) {
+    auto in{std::make_unique<Input>()};
+    in->fd = fd;
+
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p{::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                       MAP_PRIVATE, fd, 0)};
+        if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+#endif
+            in->map = static_cast<const uint8_t*>(p);
+            in->map_len = static_cast<size_t>(st.st_size);
+            in->data = in->map;
+            in->end = in->map_len;
+            in->eof = true;
+            return in;
+        }
+    }
+
+    // Room for a full read after a partial record.
+    in->buf.resize(kReadSize + kMaxRecord + 2);
+    in->data = in->buf.data();
+    return in;
+}
+
+namespace {
+
+// Move any partial record to the front of the buffer and read more after
+// it. Invalidates every record handed out so far.
+inline error::Error refill(Input& in) {
+    if (in.map != nullptr || in.eof) return error::success();
+
+    const size_t pending{in.end - in.begin};
+    memmove(in.buf.data(), in.buf.data() + in.begin, pending);
+    in.begin = 0;
+    in.end = pending;
+
+    while (true) {
+        const ssize_t n{::read(in.fd, in.buf.data() + in.end,
+                               std::min(kReadSize, in.buf.size() - in.end))};
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return error::current();
+        }
+        if (n == 0) in.eof = true;
+        in.end += static_cast<size_t>(n);
+        return error::success();
+    }
+}
+
+// The next complete record in [begin, end), if there is one: its start
+// and length, and where the one after starts.
+inline bool split(const Input& in, const Format& f,
+                  size_t& start, size_t& len, size_t& next) noexcept {
+    const uint8_t* p{in.data + in.begin};
+    const size_t avail{in.end - in.begin};
+    switch (f.mode) {
+        case Mode::LINE: {
+            const auto* nl{static_cast<const uint8_t*>(
+                    memchr(p, '\n', avail))};
+            if (nl == nullptr) {
+                if (not in.eof || avail == 0) return false;
+                start = in.begin;  // a last line without a newline
+                len = avail;
+                next = in.end;
+                return true;
+            }
+            start = in.begin;
+            len = static_cast<size_t>(nl - p);
+            next = in.begin + len + 1;
+            return true;
+        }
+        case Mode::LENGTH: {
+            if (avail < 2) return false;
+            const size_t n{(static_cast<size_t>(p[0]) << 8) | p[1]};
+            if (avail < 2 + n) return false;
+            start = in.begin + 2;
+            len = n;
+            next = start + n;
+            return true;
+        }
+        case Mode::FIXED: {
+            if (avail < f.fixed_size) return false;
+            start = in.begin;
+            len = f.fixed_size;
+            next = start + len;
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+// Fill records with up to max of the next records of at most max_len
+// bytes, each pointing into the input, and return how many there are; 0
+// at the end of input. Records stay valid until the next call.
+inline ErrorOr<size_t> next_batch(Input& in, const Format& f, size_t max_len,
+                                  struct iovec* records, size_t max) {
+    size_t count{0};
+    while (count < max) {
+        if (in.skipping) {
+            const auto* nl{static_cast<const uint8_t*>(
+                    memchr(in.data + in.begin, '\n', in.end - in.begin))};
+            if (nl != nullptr) {
+                in.begin = static_cast<size_t>(nl - in.data) + 1;
+                in.skipping = false;
+                continue;
+            }
+            in.begin = in.end;
+            if (count > 0 || in.eof) break;
+            const auto e{refill(in)};
+            if (not error::ok(e)) return e;
+            continue;
+        }
+
+        size_t start{0};
+        size_t len{0};
+        size_t next{0};
+        if (not split(in, f, start, len, next)) {
+            if (f.mode == Mode::LINE && in.end - in.begin > kMaxRecord) {
+                // Too long to ever send, and too long to buffer whole.
+                in.oversize++;
+                in.skipping = true;
+                continue;
+            }
+            if (count > 0 || in.eof) break;
+            const auto e{refill(in)};
+            if (not error::ok(e)) return e;
+            continue;
+        }
+        in.begin = next;
+        if (len > max_len) {
+            in.oversize++;
+            continue;
+        }
+        if (f.mode == Mode::LINE && len == 0) {
+            continue;  // blank line
+        }
+        records[count].iov_base = const_cast<uint8_t*>(in.data + start);
+        records[count].iov_len = len;
+        count++;
+    }
+    if (count == 0 && in.eof) {
+        in.truncated += in.end - in.begin;
+        in.begin = in.end;
+    }
+    return count;
+}
+
+}  // namespace framing
+}  // namespace mcast
+
+#endif  // MCAST_FRAMING_H
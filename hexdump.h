@@ -0,0 +1,220 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_HEXDUMP_H
+#define MCAST_HEXDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace mcast {
+namespace hexdump {
+
+// Layout of one line of 16 bytes, as printed by describe():
+//
+//     "\n    "
+//     "  hhhh hhhh hhhh hhhh  hhhh hhhh hhhh hhhh"   (missing bytes: spaces)
+//     "    "
+//     "  cccc cccc cccc cccc  cccc cccc cccc cccc"   (stops at the last byte)
+//
+// where c is the byte itself if it is a graphic ASCII character, else '.'.
+constexpr size_t kBytesPerLine{16};
+constexpr size_t kMaxLineLength{1 + 4 + 42 + 4 + 26};
+
+namespace {
+
+constexpr char kHexDigits[]{"0123456789abcdef"};
+
+inline char printable(uint8_t c) noexcept {
+    // Same as std::isgraph() in the "C" locale.
+    return (c > 0x20 && c < 0x7f) ? static_cast<char>(c) : '.';
+}
+
+// Convert up to 16 bytes: two hex digits per byte into hex[] (padded with
+// spaces to 32 characters) and one printable character per byte into chr[].
+inline void convert_scalar(const uint8_t* in, size_t n,
+                           char* hex, char* chr) noexcept {
+    for (size_t j = 0; j < kBytesPerLine; j++) {
+        if (j < n) {
+            hex[2 * j] = kHexDigits[in[j] >> 4];
+            hex[2 * j + 1] = kHexDigits[in[j] & 0x0f];
+            chr[j] = printable(in[j]);
+        } else {
+            hex[2 * j] = ' ';
+            hex[2 * j + 1] = ' ';
+        }
+    }
+}
+
+#ifdef __SSE2__
+inline __m128i nibbles_to_ascii(__m128i n) noexcept {
+    const __m128i gt9{_mm_cmpgt_epi8(n, _mm_set1_epi8(9))};
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')),
+                        _mm_and_si128(gt9, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// Convert exactly 16 bytes.
+inline void convert16(const uint8_t* in, char* hex, char* chr) noexcept {
+    const __m128i v{_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))};
+    const __m128i mask{_mm_set1_epi8(0x0f)};
+    const __m128i hi{nibbles_to_ascii(
+            _mm_and_si128(_mm_srli_epi16(v, 4), mask))};
+    const __m128i lo{nibbles_to_ascii(_mm_and_si128(v, mask))};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hex),
+                     _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hex + 16),
+                     _mm_unpackhi_epi8(hi, lo));
+
+    // Signed compares: bytes >= 0x80 are negative and fail the first test.
+    const __m128i graphic{_mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(0x20)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)))};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(chr),
+                     _mm_or_si128(_mm_and_si128(graphic, v),
+                                  _mm_andnot_si128(graphic,
+                                                   _mm_set1_epi8('.'))));
+}
+#else
+inline void convert16(const uint8_t* in, char* hex, char* chr) noexcept {
+    convert_scalar(in, kBytesPerLine, hex, chr);
+}
+#endif
+
+#ifdef __AVX2__
+inline __m256i nibbles_to_ascii(__m256i n) noexcept {
+    const __m256i gt9{_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9))};
+    return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')),
+                           _mm256_and_si256(gt9,
+                                            _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+// Convert exactly 32 bytes, i.e. two lines: hex[0..63], chr[0..31].
+inline void convert32(const uint8_t* in, char* hex, char* chr) noexcept {
+    const __m256i v{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in))};
+    const __m256i mask{_mm256_set1_epi8(0x0f)};
+    const __m256i hi{nibbles_to_ascii(
+            _mm256_and_si256(_mm256_srli_epi16(v, 4), mask))};
+    const __m256i lo{nibbles_to_ascii(_mm256_and_si256(v, mask))};
+    // Unpacking works within 128-bit lanes; put the lanes back in order.
+    const __m256i a{_mm256_unpacklo_epi8(hi, lo)};
+    const __m256i b{_mm256_unpackhi_epi8(hi, lo)};
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hex),
+                        _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hex + 32),
+                        _mm256_permute2x128_si256(a, b, 0x31));
+
+    const __m256i graphic{_mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x20)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(chr),
+                        _mm256_blendv_epi8(_mm256_set1_epi8('.'), v, graphic));
+}
+#endif
+
+// Lay out n (<= 16) converted bytes as one line; returns the end.
+inline char* put_line(char* p, const char* hex, const char* chr,
+                      size_t n) noexcept {
+    memcpy(p, "\n    ", 5);
+    p += 5;
+    for (size_t j = 0; j < kBytesPerLine; j += 2) {
+        *p++ = ' ';
+        if (j % 8 == 0) *p++ = ' ';
+        memcpy(p, hex + 2 * j, 4);
+        p += 4;
+    }
+    memcpy(p, "    ", 4);
+    p += 4;
+    for (size_t j = 0; j < n; j++) {
+        if (j % 2 == 0) *p++ = ' ';
+        if (j % 8 == 0) *p++ = ' ';
+        *p++ = chr[j];
+    }
+    return p;
+}
+
+}  // namespace
+
+// Append the hex/character dump of len bytes at data to out, one line per
+// 16 bytes, each starting with a newline. The only allocation is growing
+// out, which callers avoid by reusing the same string.
+inline void append(std::string& out, const uint8_t* data, size_t len) {
+    const size_t lines{(len + kBytesPerLine - 1) / kBytesPerLine};
+    const size_t start{out.size()};
+    out.resize(start + lines * kMaxLineLength);
+    char* const base{&out[start]};
+    char* p{base};
+
+    char hex[2 * 2 * kBytesPerLine];
+    char chr[2 * kBytesPerLine];
+    size_t i{0};
+#ifdef __AVX2__
+    for (; i + 2 * kBytesPerLine <= len; i += 2 * kBytesPerLine) {
+        convert32(data + i, hex, chr);
+        p = put_line(p, hex, chr, kBytesPerLine);
+        p = put_line(p, hex + 2 * kBytesPerLine, chr + kBytesPerLine,
+                     kBytesPerLine);
+    }
+#endif
+    for (; i + kBytesPerLine <= len; i += kBytesPerLine) {
+        convert16(data + i, hex, chr);
+        p = put_line(p, hex, chr, kBytesPerLine);
+    }
+    if (i < len) {
+        convert_scalar(data + i, len - i, hex, chr);
+        p = put_line(p, hex, chr, len - i);
+    }
+
+    out.resize(start + static_cast<size_t>(p - base));
+}
+
+// As append(), but beneath each line holding a marked byte (marks[i] is
+// non-zero) a line with '^' under that byte's hex digits and character.
+inline void append_marked(std::string& out, const uint8_t* data, size_t len,
+                          const uint8_t* marks) {
+    char line[kMaxLineLength];
+    char hex[2 * kBytesPerLine];
+    char chr[kBytesPerLine];
+    for (size_t i = 0; i < len; i += kBytesPerLine) {
+        const size_t n{std::min(len - i, kBytesPerLine)};
+        if (n == kBytesPerLine) {
+            convert16(data + i, hex, chr);
+        } else {
+            convert_scalar(data + i, n, hex, chr);
+        }
+        out.append(line, put_line(line, hex, chr, n));
+
+        bool marked{false};
+        for (size_t j = 0; j < kBytesPerLine; j++) {
+            const bool m{j < n && marks[i + j] != 0};
+            hex[2 * j] = hex[2 * j + 1] = m ? '^' : ' ';
+            chr[j] = m ? '^' : ' ';
+            marked = marked || m;
+        }
+        if (not marked) continue;
+        char* end{put_line(line, hex, chr, n)};
+        while (end > line && end[-1] == ' ') end--;
+        out.append(line, end);
+    }
+}
+
+}  // namespace hexdump
+}  // namespace mcast
+
+#endif  // MCAST_HEXDUMP_H
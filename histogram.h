@@ -0,0 +1,100 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_HISTOGRAM_H
+#define MCAST_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <sstream>
+#include <string>
+
+namespace mcast {
+namespace histogram {
+
+// An HDR-style histogram of non-negative 64-bit values: exact below
+// 2 * kSubBuckets, then kSubBuckets linear buckets per power of two, so
+// any recorded value is reported to within 1 / kSubBuckets (~1.6%).
+// Memory is fixed and recording is a couple of instructions.
+constexpr unsigned kSubBucketBits{6};
+constexpr uint64_t kSubBuckets{uint64_t{1} << kSubBucketBits};
+constexpr size_t kBuckets{(64 - kSubBucketBits + 1) * kSubBuckets};
+
+struct Histogram {
+    std::array<uint64_t, kBuckets> counts{};
+    uint64_t total{0};
+    uint64_t min{UINT64_MAX};
+    uint64_t max{0};
+};
+
+inline size_t index_of(uint64_t value) noexcept {
+    if (value < 2 * kSubBuckets) {
+        return static_cast<size_t>(value);
+    }
+    const unsigned msb{63u - static_cast<unsigned>(__builtin_clzll(value))};
+    const unsigned shift{msb - kSubBucketBits};
+    return static_cast<size_t>(shift * kSubBuckets + (value >> shift));
+}
+
+// The largest value that falls in the same bucket as index.
+inline uint64_t highest_equivalent(size_t index) noexcept {
+    if (index < 2 * kSubBuckets) {
+        return index;
+    }
+    const unsigned shift{static_cast<unsigned>(index / kSubBuckets) - 1};
+    const uint64_t sub{(index % kSubBuckets) + kSubBuckets};
+    return (sub << shift) + ((uint64_t{1} << shift) - 1);
+}
+
+inline void record(Histogram& h, uint64_t value) noexcept {
+    h.counts[index_of(value)]++;
+    h.total++;
+    h.min = std::min(h.min, value);
+    h.max = std::max(h.max, value);
+}
+
+// The value at or below which `percent` of recordings fall.
+inline uint64_t percentile(const Histogram& h, double percent) noexcept {
+    if (h.total == 0) return 0;
+    const double wanted{static_cast<double>(h.total) * percent / 100.0};
+    const uint64_t rank{std::max<uint64_t>(
+            1, static_cast<uint64_t>(wanted + 0.999999))};
+    uint64_t seen{0};
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += h.counts[i];
+        if (seen >= rank) {
+            return std::min(highest_equivalent(i), h.max);
+        }
+    }
+    return h.max;
+}
+
+// "p50 12.3 us, p99 45.6 us, p99.9 78.9 us, max 100.2 us" for values in
+// nanoseconds.
+inline std::string summary_us(const Histogram& h) {
+    std::stringstream str{};
+    str.precision(1);
+    str << std::fixed
+        << "p50 " << (percentile(h, 50) / 1e3) << " us, "
+        << "p99 " << (percentile(h, 99) / 1e3) << " us, "
+        << "p99.9 " << (percentile(h, 99.9) / 1e3) << " us, "
+        << "max " << (h.max / 1e3) << " us";
+    return str.str();
+}
+
+}  // namespace histogram
+}  // namespace mcast
+
+#endif  // MCAST_HISTOGRAM_H
@@ -12,16 +12,43 @@ LICENSE_END */
 
 #define __APPLE_USE_RFC_3542
 
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "bpf.h"
 #include "describe.h"
 #include "error.h"
+#include "filter.h"
+#include "flowtable.h"
+#include "framing.h"
+#include "histogram.h"
+#include "match.h"
+#include "metrics.h"
+#include "pace.h"
+#include "packet.h"
+#include "pcapng.h"
+#include "probe.h"
+#include "ring.h"
+#include "sink.h"
 #include "socket.h"
+#include "uring.h"
+#include "zerocopy.h"
 
 using namespace mcast;
 
@@ -32,27 +59,135 @@ void usage(const char *argv0) {
         << "Usage: " << argv0 << "\n"
         << space << "[-g multicast_group]\n"
         << space << "[-p port]\n"
-        << space << "[-l|-c]      # mode: listen (default)|client\n"
+        << space << "[-l|-c|-P]   # mode: listen (default)|client|packet capture\n"
+        << space << "[-r file]    # mode: replay a pcap/pcapng capture\n"
+        << space << "[-n pps]     # mode: generate test traffic; 0: flat out\n"
+        << space << "[-N bps]     # mode: generate test traffic at a bitrate (k/M/G)\n"
+        << space << "[-s min[-max]] # generated payload sizes; default: MTU\n"
+        << space << "[-D secs]    # stop generating after secs seconds\n"
+        << space << "[-K]         # generate: time send-to-device (TX timestamps)\n"
+        << space << "[-a]         # listen: loss/jitter/latency of generated traffic\n"
+        << space << "[-F n]       # listen: the n busiest sources, every second\n"
+        << space << "[-E pattern] # listen/capture: only datagrams containing "
+                                    "pattern; repeatable\n"
+        << space << "             #   text|hex:6d63??74|re:GET /\\d{3}|"
+                                    "@file (one per line)\n"
+        << space << "[-f filter]  # listen: drop in the kernel all but datagrams "
+                                    "matching\n"
+        << space << "             #   src addr[/bits], sport n, len n[-[m]], "
+                                    "at off hex,\n"
+        << space << "             #   joined by and/or/not and ( )\n"
+        << space << "[-x speed]   # replay speed factor; 0: as fast as possible\n"
+        << space << "[-X]         # replay: launch at SO_TXTIME (needs etf qdisc)\n"
         << space << "[-m ip_mtu]  # including headers; client mode only\n"
         << space << "[-t ttl]     # default: 1; client mode only\n"
+        << space << "[-b batch]   # datagrams per syscall; default: 1\n"
+        << space << "[-T msecs]   # max wait to fill a batch; listen mode only\n"
+        << space << "[-S]         # UDP segmentation offload; client mode only\n"
+        << space << "[-Z]         # MSG_ZEROCOPY sends; client mode only\n"
+        << space << "[-d framing] # client: one datagram per record: "
+                                    "line|length|fixed:N\n"
+        << space << "[-R]         # UDP receive offload (GRO); listen mode only\n"
+        << space << "[-L cpu]     # listen: busy-poll pinned to cpu; "
+                                    "report wakeup latency\n"
+        << space << "[-B]         # with -L: block in recvmsg, for a baseline\n"
+        << space << "[-y prio]    # with -L: run SCHED_FIFO at prio (1-99)\n"
+        << space << "[-e engine]  # I/O engine: syscall (default)|uring\n"
+        << space << "[-j threads] # receive threads, one per CPU; listen/capture\n"
+        << space << "[-q depth]   # datagrams queued for output; 0: no queue\n"
+        << space << "[-Q policy]  # when the queue is full: block|drop-newest "
+                                    "(default)|drop-oldest\n"
+        << space << "[-w file]    # write pcapng instead of text; listen/capture\n"
+        << space << "[-C MB]      # with -w: start a new file every MB megabytes\n"
+        << space << "[-G secs]    # with -w: start a new file every secs seconds\n"
+        << space << "[-M endpoint] # serve Prometheus metrics: [host:]port|unix:path\n"
+        << space << "[-i secs]    # print a metrics summary every secs seconds\n"
         << "\n"
         << "Examples:\n"
-        << space << "-g 224.0.0.251 -p 5353       # IPv4 mDNS\n"
-        << space << "-g ff02::fb -p 5353          # IPv6 mDNS\n"
+        << space << "-g 224.0.0.251 -p 5353       # IPv4 mDNS, records decoded\n"
+        << space << "-g ff02::fb -p 5353          # IPv6 mDNS, records decoded\n"
         << space << "-g 239.255.255.251 -p 10101  # google cast debug\n"
+        << space << "-f 'src 10.0.0.0/8 and at 0 6d637374'  # one subnet's probe traffic\n"
         << "\n";
 }
 
 enum class Mode {
     LISTEN,
-    CLIENT
+    CLIENT,
+    CAPTURE,
+    REPLAY,
+    GENERATE,
+};
+
+enum class Engine {
+    SYSCALL,
+    URING,
 };
 
 struct MulticastOpts {
     struct sockaddr_storage addr{};
     int hops{1};
+    bool gro{false};
+    bool tx_timestamps{false};  // client: kernel TX software timestamps
+    int busy_poll_us{0};  // listen: SO_BUSY_POLL; 0: interrupts as usual
+};
+
+struct IOOpts {
+    Engine engine{Engine::SYSCALL};
+    size_t batch_size{1};
+    int batch_timeout_ms{0};
+    bool gso{false};  // client: UDP_SEGMENT sends
+    bool zerocopy{false};  // client: MSG_ZEROCOPY sends
+    std::optional<framing::Format> framing{};  // client: records, not chunks
+    bool gro{false};  // listen: UDP_GRO receives
+    size_t threads{1};
+    size_t queue_depth{1024};
+    ring::Overflow overflow{ring::Overflow::DROP_NEWEST};
+};
+
+// Tracks how full each recvmmsg(2) batch was, reported periodically.
+struct BatchStats {
+    explicit BatchStats(size_t batch_size)
+        : capacity(batch_size),
+          last_report(std::chrono::steady_clock::now()) {}
+
+    void record(size_t filled) {
+        batches++;
+        datagrams += filled;
+        if (filled == capacity) full++;
+        min_fill = std::min(min_fill, filled);
+        max_fill = std::max(max_fill, filled);
+    }
+
+    void maybe_report(std::ostream& os) {
+        const auto now{std::chrono::steady_clock::now()};
+        if (now - last_report < std::chrono::seconds(1)) return;
+        if (batches > 0) {
+            os << "batches: " << batches
+               << " datagrams: " << datagrams
+               << " fill avg/min/max: "
+               << (static_cast<double>(datagrams) / batches)
+               << "/" << min_fill << "/" << max_fill
+               << " of " << capacity
+               << " full: " << full << "\n";
+        }
+        *this = BatchStats{capacity};
+        last_report = now;
+    }
+
+    size_t capacity{1};
+    uint64_t batches{0};
+    uint64_t datagrams{0};
+    uint64_t full{0};
+    size_t min_fill{SIZE_MAX};
+    size_t max_fill{0};
+    std::chrono::steady_clock::time_point last_report{};
 };
 
+int header_overhead(int addr_family) {
+    return ((addr_family == AF_INET) ? 20 : 40) + 8;  // IP + UDP
+}
+
 int adjust_mtu(int mtu, int addr_family) {
     // Basic bounds checking.
     if (mtu < 0) mtu = 0;
@@ -80,6 +215,40 @@ error::Error prepareListenSocket(socket::Socket& s,
     if (not error::ok(e)) return e;
     e = socket::enable(s, SOL_SOCKET, SO_REUSEPORT);
     if (not error::ok(e)) return e;
+    if (opts.gro) {
+#ifdef UDP_GRO
+        e = socket::enable(s, SOL_UDP, UDP_GRO);
+        if (not error::ok(e)) return e;
+#else
+        return error::Error{ENOPROTOOPT};
+#endif
+    }
+    // Have the kernel stamp each datagram on arrival.
+#ifdef SO_TIMESTAMPNS  // not available on macOS
+    e = socket::enable(s, SOL_SOCKET, SO_TIMESTAMPNS);
+#else
+    e = socket::enable(s, SOL_SOCKET, SO_TIMESTAMP);
+#endif
+    if (not error::ok(e)) return e;
+    // And tell us how many it had to drop for want of buffer space.
+#ifdef SO_RXQ_OVFL  // not available on macOS
+    e = socket::enable(s, SOL_SOCKET, SO_RXQ_OVFL);
+    if (not error::ok(e)) return e;
+#endif
+    if (opts.busy_poll_us > 0) {
+        // Like the rest of latency mode's setup, worth having but not
+        // worth failing for: receives still spin, only on the socket.
+#ifdef SO_BUSY_POLL  // not available on macOS
+        const auto busy_poll_e{
+                socket::enable_busy_poll(s, opts.busy_poll_us)};
+#else
+        const error::Error busy_poll_e{ENOPROTOOPT};
+#endif
+        if (not error::ok(busy_poll_e)) {
+            std::cerr << "SO_BUSY_POLL: " << error::to_string(busy_poll_e)
+                      << "\n";
+        }
+    }
 
     switch (opts.addr.ss_family) {
         case AF_INET: {
@@ -158,6 +327,15 @@ error::Error prepareListenSocket(socket::Socket& s,
 
 error::Error prepareClientSocket(socket::Socket& s,
                                  const struct MulticastOpts& opts) {
+    if (opts.tx_timestamps) {
+#ifdef SO_TIMESTAMPING
+        const auto e = socket::enable_tx_timestamps(s);
+        if (not error::ok(e)) return e;
+#else
+        return error::Error{ENOPROTOOPT};
+#endif
+    }
+
     switch (opts.addr.ss_family) {
         case AF_INET: {
             struct sockaddr_in client4{};
@@ -206,30 +384,1263 @@ error::Error prepareClientSocket(socket::Socket& s,
     }
 }
 
+// A datagram on its way from a receive thread to the formatter thread.
+struct Received {
+    struct sockaddr_storage from{};
+    socket::AuxiliaryData aux{};
+    size_t len{0};
+    uint8_t data[sizeof(socket::Msg::pckt)]{};
+};
+
+// Where receive loops deliver datagrams: formatted in place, or, given a
+// queue, copied to a formatter thread so that a slow terminal or pipe
+// never holds up the network path. With a pcapng writer, datagrams are
+// recorded rather than described; with an analyzer or flow table, they
+// are only counted. With a matcher, only datagrams matching one of its
+// patterns go anywhere, and descriptions point out the matches.
+struct Output {
+    Sink& sink;
+    ring::Ring<Received>* queue{nullptr};
+    pcapng::Writer* pcap{nullptr};
+    probe::Analyzer* analyzer{nullptr};
+    flowtable::Flows* flows{nullptr};
+    const match::Matcher* matcher{nullptr};
+    in_port_t port{0};  // that datagrams were sent to, in host order
+};
+
+void deliver(Output& out,
+             const struct sockaddr_storage& from,
+             const socket::AuxiliaryData& aux,
+             const uint8_t* data, size_t len) {
+    if (out.analyzer != nullptr) {
+        probe::record(*out.analyzer, from, aux, data, len);
+    }
+    if (out.flows != nullptr) {
+        flowtable::record(*out.flows, from, aux, data, len);
+    }
+    if (out.pcap != nullptr) {
+        const auto e{pcapng::write(*out.pcap, from, aux, data, len)};
+        if (not error::ok(e)) {
+            std::cerr << "pcapng: " << error::to_string(e) << "\n";
+        }
+        return;
+    }
+    if (out.analyzer != nullptr || out.flows != nullptr) {
+        return;
+    }
+
+    thread_local std::string record{};
+    if (out.matcher != nullptr) {
+        thread_local std::vector<match::Match> matches{};
+        thread_local std::vector<Highlight> highlights{};
+        match::all(*out.matcher, data, len, matches);
+        highlights.clear();
+        for (const auto& m : matches) {
+            highlights.push_back({m.offset, m.len,
+                                  &(out.matcher->patterns[m.pattern].text)});
+        }
+        describe_into(record, from, aux, data, len, highlights, out.port);
+    } else {
+        describe_into(record, from, aux, data, len, {}, out.port);
+    }
+    write(out.sink, record);
+}
+
+// Print one received buffer, splitting UDP GRO super-datagrams back into
+// the datagrams they were coalesced from.
+void emit(Output& out,
+          const struct sockaddr_storage& from,
+          const socket::AuxiliaryData& aux,
+          const uint8_t* data, size_t len) {
+    socket::for_each_segment(data, len, aux,
+            [&](const uint8_t* segment, size_t seglen) {
+                metrics::received(aux, seglen);
+                if (out.matcher != nullptr &&
+                    not match::any(*out.matcher, segment, seglen)) {
+                    return;
+                }
+                if (out.queue != nullptr) {
+                    ring::push(*out.queue, [&](Received& r) {
+                        r.from = from;
+                        r.aux = aux;
+                        r.len = std::min(seglen, sizeof(r.data));
+                        memcpy(r.data, segment, r.len);
+                    });
+                    return;
+                }
+                deliver(out, from, aux, segment, seglen);
+            });
+}
+
+// Reports queue overflows, at most once a second and only when something
+// was dropped or had to wait.
+struct QueueStats {
+    void maybe_report(const ring::Counters& c, std::ostream& os) {
+        const auto now{std::chrono::steady_clock::now()};
+        if (now - last_report < std::chrono::seconds(1)) return;
+        last_report = now;
+
+        const uint64_t newest{c.dropped_newest.load()};
+        const uint64_t oldest{c.dropped_oldest.load()};
+        const uint64_t blocked{c.blocked.load()};
+        if (newest == dropped_newest && oldest == dropped_oldest &&
+            blocked == blocked_pushes) {
+            return;
+        }
+        os << "queue: " << c.pushed.load() << " queued, "
+           << (newest - dropped_newest) << " dropped (newest), "
+           << (oldest - dropped_oldest) << " dropped (oldest), "
+           << (blocked - blocked_pushes) << " blocked pushes\n";
+        dropped_newest = newest;
+        dropped_oldest = oldest;
+        blocked_pushes = blocked;
+    }
+
+    uint64_t dropped_newest{0};
+    uint64_t dropped_oldest{0};
+    uint64_t blocked_pushes{0};
+    std::chrono::steady_clock::time_point last_report{
+            std::chrono::steady_clock::now()};
+};
+
+// Drain the queue, in order. A pcapng writer is flushed whenever the
+// queue runs dry.
+void runFormatter(Output& out) {
+    auto& queue{*out.queue};
+    auto item{std::make_unique<Received>()};
+    ring::Backoff backoff{};
+    QueueStats stats{};
+    while (true) {
+        stats.maybe_report(queue.counters, std::cerr);
+        if (not ring::pop(queue, *item)) {
+            if (backoff.spins == 0 && out.pcap != nullptr) {
+                pcapng::sync(*out.pcap);
+            }
+            backoff.pause();
+            continue;
+        }
+        backoff.reset();
+        deliver(out, item->from, item->aux, item->data, item->len);
+    }
+}
+
+template<size_t Size>
+void emit(Output& out, const socket::BasicMsg<Size>& msg, ssize_t rcvd) {
+    if (rcvd < 0) {
+        return;
+    }
+    emit(out, msg.ss, socket::parse_aux(msg), msg.pckt, rcvd);
+}
+
+template<size_t Size>
+void runListenWith(socket::Socket& s, const struct IOOpts& io_opts,
+                   Output& out) {
+    if (io_opts.batch_size <= 1) {
+        auto msg{std::make_unique<socket::BasicMsg<Size>>()};
+        while (true) {
+            const auto rval = socket::recvmsg(s, *msg);
+            if (not ok(rval)) {
+                metrics::count_error(rval);
+                std::cerr << to_string(rval) << "\n";
+                continue;
+            }
+
+            metrics::batch(1);
+            emit(out, *msg, get_valueref_unsafe(rval));
+        }
+    }
+
+    socket::BasicMsgBatch<Size> batch{io_opts.batch_size};
+    BatchStats stats{batch.size()};
+    while (true) {
+        const auto rval = socket::recvmmsg(s, batch, io_opts.batch_timeout_ms);
+        if (not ok(rval)) {
+            metrics::count_error(rval);
+            std::cerr << to_string(rval) << "\n";
+            continue;
+        }
+
+        const size_t filled{get_valueref_unsafe(rval)};
+        for (size_t i = 0; i < filled; i++) {
+            emit(out, batch.msgs[i], batch.lens[i]);
+        }
+
+        metrics::batch(filled);
+        stats.record(filled);
+        stats.maybe_report(std::cerr);
+    }
+}
+
+#ifdef MCAST_HAVE_URING
+// Returns false, having received nothing, if io_uring (or multishot
+// recvmsg) is unavailable and the caller should fall back to syscalls.
+bool runListenUring(socket::Socket& s, const struct IOOpts& io_opts,
+                    Output& out) {
+    // Coalesced GRO receives need room for a full 64 KB payload.
+    const size_t payload{io_opts.gro ? sizeof(socket::JumboMsg::pckt)
+                                     : sizeof(socket::Msg::pckt)};
+    const unsigned nbufs{io_opts.gro ? 64u : 1024u};
+
+    auto rx_or{uring::make_receiver({s.fd}, nbufs, payload)};
+    if (not ok(rx_or)) {
+        std::cerr << "io_uring unavailable (" << to_string(rx_or) << ")\n";
+        return false;
+    }
+    auto& rx{*get_valueref_unsafe(rx_or)};
+
+    BatchStats stats{nbufs};
+    bool received_any{false};
+    while (true) {
+        const auto rval = uring::receive(rx,
+                [&out](size_t, const struct sockaddr_storage& from,
+                        const socket::AuxiliaryData& aux,
+                        const uint8_t* data, size_t len) {
+                    emit(out, from, aux, data, len);
+                });
+        if (not ok(rval)) {
+            if (not received_any) {
+                std::cerr << "io_uring recvmsg failed ("
+                          << to_string(rval) << ")\n";
+                return false;
+            }
+            metrics::count_error(rval);
+            std::cerr << to_string(rval) << "\n";
+            continue;
+        }
+
+        const size_t filled{get_valueref_unsafe(rval)};
+        if (filled == 0) {
+            continue;
+        }
+        received_any = true;
+        metrics::batch(filled);
+        stats.record(filled);
+        stats.maybe_report(std::cerr);
+    }
+}
+#endif
+
+void runListen(socket::Socket& s, const struct IOOpts& io_opts, Output& out) {
+    if (io_opts.engine == Engine::URING) {
+#ifdef MCAST_HAVE_URING
+        runListenUring(s, io_opts, out);
+#endif
+        std::cerr << "falling back to the syscall engine\n";
+    }
+
+    // Coalesced GRO receives need room for a full 64 KB payload.
+    if (io_opts.gro) {
+        runListenWith<sizeof(socket::JumboMsg)>(s, io_opts, out);
+    } else {
+        runListenWith<sizeof(socket::Msg)>(s, io_opts, out);
+    }
+}
+
+// Pin to CPUs first, first + stride, first + 2 * stride, ... below limit.
+error::Error pinThisThread(unsigned first, unsigned stride, unsigned limit) {
+#ifdef __linux__
+    cpu_set_t set{};
+    CPU_ZERO(&set);
+    for (unsigned cpu = first; cpu < limit; cpu += stride) {
+        CPU_SET(cpu, &set);
+    }
+    return error::Error{
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set)};
+#else
+    (void)first;
+    (void)stride;
+    (void)limit;
+    return error::Error{ENOTSUP};
+#endif
+}
+
+error::Error pinThisThread(unsigned cpu) {
+    return pinThisThread(cpu, 1, cpu + 1);
+}
+
+// Listen latency mode: a single receive thread, pinned to one CPU,
+// spinning on non-blocking receives from a busy-polling socket so that a
+// datagram never waits for the thread to be woken.
+struct LatencyOpts {
+    int cpu{-1};  // -1: latency mode off
+    int fifo_priority{0};  // 0: leave the scheduling policy alone
+    bool spin{true};  // false: block in recvmsg(), for comparison
+};
+
+// How long the kernel busy-polls a device queue per receive.
+constexpr int kBusyPollUs{50};
+
+// How long each datagram took from its kernel arrival timestamp to being
+// back in userspace, reported each second.
+struct WakeupStats {
+    void record(const socket::AuxiliaryData& aux, uint64_t seen_ns) {
+        if (not socket::has_rx_time(aux)) return;
+        const auto ts{socket::get_rx_time(aux)};
+        const uint64_t rx_ns{static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 +
+                             static_cast<uint64_t>(ts.tv_nsec)};
+        if (seen_ns < rx_ns) return;  // the clock was stepped
+        histogram::record(latency, seen_ns - rx_ns);
+    }
+
+    void maybe_report(std::ostream& os) {
+        const auto now{std::chrono::steady_clock::now()};
+        if (now - last_report < std::chrono::seconds(1)) return;
+        if (latency.total > 0) {
+            os << "wakeup latency: " << histogram::summary_us(latency)
+               << " (" << latency.total << " datagrams)\n";
+        }
+        latency = histogram::Histogram{};
+        last_report = now;
+    }
+
+    histogram::Histogram latency{};
+    std::chrono::steady_clock::time_point last_report{
+            std::chrono::steady_clock::now()};
+};
+
+// Pin the calling thread, maybe make it SCHED_FIFO, and lock every page
+// of the process in memory so that no receive waits on a page fault.
+// Failures are reported but not fatal: latency mode still works, only
+// less well.
+void prepareLatencyThread(const LatencyOpts& latency) {
+    auto e{pinThisThread(static_cast<unsigned>(latency.cpu))};
+    if (not error::ok(e)) {
+        std::cerr << "cannot pin to CPU " << latency.cpu << ": "
+                  << error::to_string(e) << "\n";
+    }
+    if (latency.fifo_priority > 0) {
+        struct sched_param param{};
+        param.sched_priority = latency.fifo_priority;
+        e = error::Error{
+                ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &param)};
+        if (not error::ok(e)) {
+            std::cerr << "SCHED_FIFO: " << error::to_string(e) << "\n";
+        }
+    }
+    if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "mlockall: " << error::to_string(error::current())
+                  << "\n";
+    }
+}
+
+template<size_t Size>
+void runListenLowLatencyWith(socket::Socket& s, const LatencyOpts& latency,
+                             Output& out) {
+    auto msg{std::make_unique<socket::BasicMsg<Size>>()};
+    prepareLatencyThread(latency);
+
+    // Without blocking, each receive busy-polls the device queue once.
+    const int flags{latency.spin ? MSG_DONTWAIT : 0};
+    WakeupStats stats{};
+    while (true) {
+        const auto rval = socket::recvmsg(s, *msg, flags);
+        if (not ok(rval)) {
+            const int num{get_error(rval).num};
+            if (num == EAGAIN || num == EWOULDBLOCK || num == EINTR) {
+                continue;
+            }
+            metrics::count_error(rval);
+            std::cerr << to_string(rval) << "\n";
+            continue;
+        }
+        const uint64_t seen_ns{pace::now_ns(CLOCK_REALTIME)};
+
+        const auto aux{socket::parse_aux(*msg)};
+        stats.record(aux, seen_ns);
+        metrics::batch(1);
+        emit(out, msg->ss, aux, msg->pckt, get_valueref_unsafe(rval));
+        stats.maybe_report(std::cerr);
+    }
+}
+
+void runListenLowLatency(socket::Socket& s, const struct IOOpts& io_opts,
+                         const LatencyOpts& latency, Output& out) {
+    // Coalesced GRO receives need room for a full 64 KB payload.
+    if (io_opts.gro) {
+        runListenLowLatencyWith<sizeof(socket::JumboMsg)>(s, latency, out);
+    } else {
+        runListenLowLatencyWith<sizeof(socket::Msg)>(s, latency, out);
+    }
+}
+
+#ifdef __linux__
+// One socket per thread, each joined to the group. A cBPF filter on
+// socket i keeps only the datagrams whose softirq ran on a CPU congruent
+// to i, and its thread runs only on those CPUs, so each flow stays on the
+// core that the NIC (RSS/RPS) already steers it to; then any -f filter.
+// With one thread per CPU that is exactly one CPU each; more threads than
+// CPUs would have nothing to do.
+//
+// Multicast is delivered to every socket joined to the group, so the
+// kernel clones each datagram n times only for n - 1 filters to drop it.
+void runListenThreads(const struct MulticastOpts& opts,
+                      const struct IOOpts& io_opts,
+                      const bpf::Program& filter_prog, Output& out) {
+    const unsigned ncpus{std::max(1u, std::thread::hardware_concurrency())};
+    const unsigned n{std::min(static_cast<unsigned>(io_opts.threads), ncpus)};
+    std::cerr << "listening on " << n << " sockets";
+    if (n < io_opts.threads) std::cerr << " (one per CPU)";
+    std::cerr << "...\n";
+
+    // Sockets register cleanups that refer to themselves, so they must
+    // not move once prepared.
+    std::vector<std::unique_ptr<socket::Socket>> sockets{};
+    for (unsigned i = 0; i < n; i++) {
+        auto socket_or{socket::makeForFamily(opts.addr.ss_family)};
+        if (not ok(socket_or)) {
+            std::cerr << to_string(socket_or) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        sockets.push_back(std::make_unique<socket::Socket>(
+                std::move(get_valueref_unsafe(socket_or))));
+        auto& s{*sockets.back()};
+
+        for (const auto& e :
+                {
+                    bpf::attach(s, filter_prog.empty()
+                            ? bpf::cpu_steering(i, n)
+                            : bpf::both(bpf::cpu_steering(i, n), filter_prog)),
+                    prepareListenSocket(s, opts),
+                }) {
+            if (not error::ok(e)) {
+                std::cerr << error::to_string(e) << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    std::vector<std::thread> workers{};
+    for (unsigned i = 0; i < n; i++) {
+        workers.emplace_back([i, n, ncpus, &sockets, &io_opts, &out]() {
+            const auto e{pinThisThread(i, n, ncpus)};
+            if (not error::ok(e)) {
+                std::cerr << "cannot pin thread " << i << ": "
+                          << error::to_string(e) << "\n";
+            }
+            runListen(*sockets[i], io_opts, out);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+#endif
+
+#ifdef MCAST_HAVE_PACKET
+// Monitor the group through AF_PACKET rings without joining it. With more
+// than one thread the rings form a PACKET_FANOUT group and share the load.
+void runCapture(const struct sockaddr_storage& group, size_t threads,
+                Output& out) {
+    const int fanout_id{(threads > 1) ? (::getpid() & 0xffff) : -1};
+
+    std::vector<std::unique_ptr<packet::Ring>> rings{};
+    for (size_t i = 0; i < threads; i++) {
+        auto ring_or{packet::open(group, fanout_id)};
+        if (not ok(ring_or)) {
+            std::cerr << "packet capture: " << to_string(ring_or) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        rings.push_back(std::move(get_valueref_unsafe(ring_or)));
+    }
+
+    std::vector<std::thread> workers{};
+    for (auto& ring : rings) {
+        workers.emplace_back([&ring, &out]() {
+            while (true) {
+                const auto rval = packet::capture(*ring, 1000,
+                        [&out](const packet::Datagram& d) {
+                            emit(out, d.from, d.aux, d.data, d.len);
+                        });
+                if (not ok(rval)) {
+                    metrics::count_error(rval);
+                    std::cerr << to_string(rval) << "\n";
+                } else if (get_valueref_unsafe(rval) > 0) {
+                    metrics::batch(get_valueref_unsafe(rval));
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+#endif
+
+// Aggregated client-side progress, reported periodically and at exit.
+struct SendStats {
+    void record(size_t datagrams_sent, size_t bytes_sent) {
+        metrics::sent(datagrams_sent, bytes_sent);
+        calls++;
+        datagrams += datagrams_sent;
+        bytes += bytes_sent;
+    }
+
+    // A send call that sent nothing.
+    void failure(const error::Error& e) {
+        metrics::count_error(e);
+        failed++;
+        last_error = e;
+    }
+
+    void report(std::ostream& os) const {
+        os << "sent " << bytes << " bytes in " << datagrams
+           << " datagrams (" << calls << " calls";
+        if (failed > 0) {
+            os << ", " << failed << " failed: "
+               << error::to_string(last_error);
+        }
+        os << ")\n";
+    }
+
+    void maybe_report(std::ostream& os) {
+        const auto now{std::chrono::steady_clock::now()};
+        if (now - last_report < std::chrono::seconds(1)) return;
+        report(os);
+        last_report = now;
+    }
+
+    uint64_t calls{0};
+    uint64_t datagrams{0};
+    uint64_t bytes{0};
+    uint64_t failed{0};
+    error::Error last_error{};
+    std::chrono::steady_clock::time_point last_report{
+            std::chrono::steady_clock::now()};
+};
+
+void runClient(socket::Socket& s, int mtu, const struct IOOpts& io_opts) {
+#ifdef MCAST_HAVE_URING
+    std::unique_ptr<uring::Sender> tx{};
+    if (io_opts.engine == Engine::URING) {
+        auto tx_or{uring::make_sender(io_opts.batch_size)};
+        if (ok(tx_or)) {
+            tx = std::move(get_valueref_unsafe(tx_or));
+        } else {
+            std::cerr << "io_uring unavailable (" << to_string(tx_or)
+                      << "); falling back to the syscall engine\n";
+        }
+    }
+    const bool use_uring{tx != nullptr};
+#else
+    if (io_opts.engine == Engine::URING) {
+        std::cerr << "io_uring not supported; "
+                  << "falling back to the syscall engine\n";
+    }
+    const bool use_uring{false};
+#endif
+
+    if (io_opts.batch_size <= 1 && not use_uring) {
+        socket::Msg msg{};
+        while (true) {
+            const auto consumed{fread(msg.pckt, 1, mtu, stdin)};
+            if (consumed == 0) {
+                break;
+            }
+            const auto rval = socket::sendmsg(s, msg, consumed);
+            if (not ok(rval)) {
+                metrics::count_error(rval);
+                std::cerr << to_string(rval) << "\n";
+            } else {
+                metrics::sent(1, consumed);
+            }
+
+            std::cerr << "sent " << consumed << " bytes\n";
+        }
+        return;
+    }
+
+    socket::MsgBatch batch{io_opts.batch_size};
+    SendStats stats{};
+    bool eof{false};
+    while (not eof) {
+        size_t staged{0};
+        while (staged < batch.size()) {
+            const auto consumed{fread(batch.msgs[staged].pckt, 1, mtu, stdin)};
+            if (consumed == 0) {
+                eof = true;
+                break;
+            }
+            batch.lens[staged++] = consumed;
+        }
+        if (staged == 0) {
+            break;
+        }
+
+        // A short send leaves the rest of the batch unsent: move it to the
+        // front and try again, which either sends it or says why not.
+        while (staged > 0) {
+#ifdef MCAST_HAVE_URING
+            const auto rval = use_uring
+                    ? uring::sendmmsg(*tx, s, batch, staged)
+                    : socket::sendmmsg(s, batch, staged);
+#else
+            const auto rval = socket::sendmmsg(s, batch, staged);
+#endif
+            if (not ok(rval)) {
+                metrics::count_error(rval);
+                std::cerr << to_string(rval) << "; dropped " << staged
+                          << " datagrams\n";
+                break;
+            }
+
+            const size_t sent{get_valueref_unsafe(rval)};
+            size_t bytes{0};
+            for (size_t i = 0; i < sent; i++) {
+                bytes += batch.lens[i];
+            }
+            stats.record(sent, bytes);
+            staged -= sent;
+            for (size_t i = 0; i < staged; i++) {
+                batch.lens[i] = batch.lens[sent + i];
+                memcpy(batch.msgs[i].pckt, batch.msgs[sent + i].pckt,
+                       batch.lens[i]);
+            }
+        }
+        stats.maybe_report(std::cerr);
+    }
+    stats.report(std::cerr);
+}
+
+#ifdef UDP_SEGMENT
+// The kernel refuses GSO sends of more than UDP_MAX_SEGMENTS segments.
+constexpr size_t kMaxGsoSegments{64};
+
+// The most stdin to hand the kernel per GSO send: whole segments only, so
+// that just the final send can be short.
+size_t gso_chunk(int mtu, int addr_family) {
+    const size_t max_payload{std::min({
+            kMaxGsoSegments * mtu,
+            sizeof(socket::JumboMsg::pckt),
+            static_cast<size_t>(0xffff - header_overhead(addr_family))})};
+    return max_payload - (max_payload % mtu);
+}
+
+// Hand the kernel up to 64 KB of stdin per sendmsg(), to be split into
+// mtu-sized datagrams on the way out.
+void runClientGso(socket::Socket& s, int mtu, int addr_family) {
+    auto msg{std::make_unique<socket::JumboMsg>()};
+    const size_t chunk{gso_chunk(mtu, addr_family)};
+    socket::set_segment_size(*msg, static_cast<uint16_t>(mtu));
+
+    SendStats stats{};
+    bool gso{true};
+    socket::Msg single{};
+    while (true) {
+        const auto consumed{fread(msg->pckt, 1, chunk, stdin)};
+        if (consumed == 0) {
+            break;
+        }
+
+        if (gso) {
+            const auto rval = socket::sendmsg(s, *msg, consumed);
+            if (ok(rval)) {
+                stats.record((consumed + mtu - 1) / mtu, consumed);
+                stats.maybe_report(std::cerr);
+                continue;
+            }
+            metrics::count_error(rval);
+            std::cerr << "UDP GSO send failed (" << to_string(rval)
+                      << "); sending datagrams individually\n";
+            gso = false;
+        }
+
+        for (size_t off = 0; off < consumed; off += mtu) {
+            const size_t len{std::min(consumed - off, static_cast<size_t>(mtu))};
+            memcpy(single.pckt, msg->pckt + off, len);
+            const auto rval = socket::sendmsg(s, single, len);
+            if (not ok(rval)) {
+                metrics::count_error(rval);
+                std::cerr << to_string(rval) << "\n";
+                continue;
+            }
+            stats.record(1, len);
+        }
+        stats.maybe_report(std::cerr);
+    }
+    stats.report(std::cerr);
+}
+#endif
+
+// Send each record of stdin as one datagram, batch_size records per
+// sendmmsg(), straight from the mapped file or read buffer.
+void runClientFramed(socket::Socket& s, int mtu, const struct IOOpts& io_opts) {
+    auto in_or{framing::open(STDIN_FILENO)};
+    if (not ok(in_or)) {
+        std::cerr << "stdin: " << to_string(in_or) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    auto& in{*get_valueref_unsafe(in_or)};
+
+    std::vector<struct iovec> records(io_opts.batch_size);
+    SendStats stats{};
+    while (true) {
+        const auto count_or{framing::next_batch(in, *io_opts.framing, mtu,
+                                                records.data(),
+                                                records.size())};
+        if (not ok(count_or)) {
+            metrics::count_error(count_or);
+            std::cerr << "stdin: " << to_string(count_or) << "\n";
+            break;
+        }
+        const size_t count{get_valueref_unsafe(count_or)};
+        if (count == 0) {
+            break;
+        }
+
+        // Records are only valid until the next batch: send them all.
+        size_t done{0};
+        while (done < count) {
+            const auto rval = socket::send_iovecs(s, records.data() + done,
+                                                  count - done);
+            if (not ok(rval)) {
+                metrics::count_error(rval);
+                std::cerr << to_string(rval) << "\n";
+                done++;  // give up on this one
+                continue;
+            }
+            const size_t sent{get_valueref_unsafe(rval)};
+            size_t bytes{0};
+            for (size_t i = done; i < done + sent; i++) {
+                bytes += records[i].iov_len;
+            }
+            stats.record(sent, bytes);
+            done += sent;
+        }
+        stats.maybe_report(std::cerr);
+    }
+    stats.report(std::cerr);
+    if (in.oversize > 0) {
+        std::cerr << "skipped " << in.oversize
+                  << " records longer than " << mtu << " bytes\n";
+    }
+    if (in.truncated > 0) {
+        std::cerr << "ignored " << in.truncated
+                  << " bytes of an incomplete final record\n";
+    }
+}
+
+#ifdef MCAST_HAVE_ZEROCOPY
+// Send chunk bytes of stdin at a time with MSG_ZEROCOPY, from a pool of
+// buffers that are reused only once the kernel reports it is done with
+// them. With gso_size, each send is split into datagrams of that size.
+template<size_t Size>
+void runClientZerocopyWith(socket::Socket& s, size_t chunk, int gso_size) {
+    constexpr size_t kBuffers{64};
+    auto pool{std::make_unique<zerocopy::Pool<Size>>(kBuffers)};
+#ifdef UDP_SEGMENT
+    if (gso_size > 0) {
+        for (auto& msg : pool->msgs) {
+            socket::set_segment_size(msg, static_cast<uint16_t>(gso_size));
+        }
+    }
+#endif
+
+    SendStats stats{};
+    while (true) {
+        auto& msg{zerocopy::acquire(*pool, s)};
+        const auto consumed{fread(msg.pckt, 1, chunk, stdin)};
+        if (consumed == 0) {
+            break;
+        }
+
+        auto rval = socket::sendmsg(s, msg, consumed, MSG_ZEROCOPY);
+        // Out of option memory for pinning pages: wait for some back.
+        while (not ok(rval) && get_error(rval).num == ENOBUFS &&
+               pool->in_flight > 0) {
+            zerocopy::wait(*pool, s, 100);
+            rval = socket::sendmsg(s, msg, consumed, MSG_ZEROCOPY);
+        }
+        if (not ok(rval)) {
+            metrics::count_error(rval);
+            std::cerr << to_string(rval) << "\n";
+            continue;
+        }
+        zerocopy::sent(*pool);
+
+        const size_t segment{(gso_size > 0) ? static_cast<size_t>(gso_size)
+                                            : consumed};
+        stats.record((consumed + segment - 1) / segment, consumed);
+        stats.maybe_report(std::cerr);
+    }
+
+    zerocopy::drain(*pool, s, 1000);
+    stats.report(std::cerr);
+    std::cerr << "zerocopy: " << pool->completions << " sends completed, "
+              << pool->copied << " copied by the kernel anyway";
+    if (pool->in_flight > 0) {
+        std::cerr << ", " << pool->in_flight << " never completed";
+    }
+    std::cerr << "\n";
+}
+
+void runClientZerocopy(socket::Socket& s, int mtu, int addr_family,
+                       bool gso) {
+    const auto e{socket::enable_zerocopy(s)};
+    if (not error::ok(e)) {
+        std::cerr << "SO_ZEROCOPY: " << error::to_string(e) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    if (gso) {
+#ifdef UDP_SEGMENT
+        runClientZerocopyWith<sizeof(socket::JumboMsg)>(
+                s, gso_chunk(mtu, addr_family), mtu);
+        return;
+#else
+        std::cerr << "UDP GSO is not supported on this platform\n";
+        exit(EXIT_FAILURE);
+#endif
+    }
+    runClientZerocopyWith<sizeof(socket::Msg)>(s, mtu, 0);
+}
+#endif
+
+struct ReplayOpts {
+    std::string path{};
+    double speed{1.0};  // 0: as fast as possible
+    bool txtime{false};
+};
+
+// Re-send the UDP payloads of a capture to the group, reproducing the
+// recorded gaps between them (divided by opts.speed). Userspace pacing
+// sleeps, then spins. With opts.txtime each datagram also carries its
+// launch time, and the etf qdisc sends it then; we only need to hand it
+// over a little early.
+void runReplay(socket::Socket& s, const struct ReplayOpts& opts) {
+    auto reader_or{pcapng::open_reader(opts.path)};
+    if (not ok(reader_or)) {
+        std::cerr << opts.path << ": " << to_string(reader_or) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    auto& reader{*get_valueref_unsafe(reader_or)};
+
+    uint64_t tai_offset{0};
+    uint64_t lead_ns{0};
+    if (opts.txtime) {
+#ifdef SO_TXTIME
+        const auto e{socket::enable_txtime(s, CLOCK_TAI)};
+        if (not error::ok(e)) {
+            std::cerr << "SO_TXTIME: " << error::to_string(e) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        tai_offset = pace::now_ns(CLOCK_TAI) - pace::now_ns();
+        lead_ns = 2'000'000;
+#else
+        std::cerr << "SO_TXTIME is not supported on this platform\n";
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+    SendStats stats{};
+    socket::Msg msg{};
+    pcapng::Frame frame{};
+    bool first{true};
+    uint64_t first_ts{0};
+    uint64_t start{0};
+    uint64_t max_late{0};
+    uint64_t skipped{0};
+    uint64_t truncated{0};
+    // Launch-time misses queue up on the error queue, which holds only so
+    // much: read them as the replay goes.
+    constexpr uint64_t kMissCheckInterval{64};
+    uint64_t missed{0};
+    while (pcapng::next(reader, frame)) {
+        const uint8_t* payload{nullptr};
+        size_t len{0};
+        if (not pcapng::udp_payload(frame, payload, len)) {
+            skipped++;
+            continue;
+        }
+        if (len > sizeof(msg.pckt)) {
+            len = sizeof(msg.pckt);
+            truncated++;
+        }
+        memcpy(msg.pckt, payload, len);
+
+        if (first) {
+            first = false;
+            first_ts = frame.ts_ns;
+            start = pace::now_ns() + lead_ns;
+        }
+        if (opts.speed > 0) {
+            const uint64_t offset{(frame.ts_ns > first_ts)
+                    ? static_cast<uint64_t>(
+                            static_cast<double>(frame.ts_ns - first_ts) /
+                            opts.speed)
+                    : 0};
+            const uint64_t deadline{start + offset};
+#ifdef SO_TXTIME
+            if (opts.txtime) {
+                socket::set_txtime(msg, deadline + tai_offset);
+            }
+#endif
+            max_late = std::max(max_late, pace::until(deadline - lead_ns));
+        }
+
+        const auto rval = socket::sendmsg(s, msg, len);
+        if (not ok(rval)) {
+            metrics::count_error(rval);
+            std::cerr << to_string(rval) << "\n";
+            continue;
+        }
+        stats.record(1, len);
+        stats.maybe_report(std::cerr);
+#ifdef __linux__
+        if (opts.txtime && stats.datagrams % kMissCheckInterval == 0) {
+            missed += socket::drain_error_queue(s);
+        }
+#endif
+    }
+
+    stats.report(std::cerr);
+    if (skipped > 0) {
+        std::cerr << "skipped " << skipped << " non-UDP frames\n";
+    }
+    if (truncated > 0) {
+        std::cerr << "truncated " << truncated << " payloads to "
+                  << sizeof(msg.pckt) << " bytes\n";
+    }
+    if (opts.speed > 0) {
+        std::cerr << "max lateness: " << (max_late / 1000) << " us\n";
+    }
+#ifdef __linux__
+    if (opts.txtime) {
+        // The last datagrams are still waiting in the qdisc for up to
+        // lead_ns: let them launch, or miss, first.
+        std::this_thread::sleep_for(
+                std::chrono::nanoseconds(2 * lead_ns));
+        missed += socket::drain_error_queue(s);
+        if (missed > 0) {
+            std::cerr << missed << " datagrams missed their launch time\n";
+        }
+    }
+#else
+    (void)kMissCheckInterval;
+#endif
+}
+
+struct GenerateOpts {
+    double pps{0};   // 0: as fast as possible
+    double bps{0};   // if set, overrides pps
+    size_t min_size{0};  // 0: the MTU
+    size_t max_size{0};
+    double duration_s{0};  // 0: forever
+    bool tx_timestamps{false};
+};
+
+// Send probe::Header-stamped datagrams at a steady rate, batch_size at a
+// time, until stopped. Sizes are drawn uniformly from [min_size,
+// max_size], limited to what fits the MTU. Where the socket has transmit
+// timestamps, the time from stamping a datagram to the kernel handing it
+// to the device is reported as well (opts.tx_timestamps): reading them
+// back costs a syscall per send.
+void runGenerate(socket::Socket& s, int mtu, int addr_family,
+                 const struct IOOpts& io_opts,
+                 const struct GenerateOpts& opts,
+                 const std::atomic<bool>& stop) {
+    const size_t limit{static_cast<size_t>(mtu)};
+    const auto clamp_size = [limit](size_t size) {
+        if (size == 0) return limit;
+        return std::max(probe::kHeaderSize, std::min(size, limit));
+    };
+    const size_t min_size{clamp_size(opts.min_size)};
+    const size_t max_size{std::max(min_size, clamp_size(
+            (opts.max_size > 0) ? opts.max_size : opts.min_size))};
+
+    double pps{opts.pps};
+    if (opts.bps > 0) {
+        const double avg_wire_bytes{(min_size + max_size) / 2.0 +
+                                    header_overhead(addr_family)};
+        pps = opts.bps / (8 * avg_wire_bytes);
+    }
+    const double interval_ns{(pps > 0) ? 1e9 / pps : 0};
+    std::cerr << "generating " << min_size << "-" << max_size << " byte "
+              << "datagrams at "
+              << ((pps > 0) ? std::to_string(static_cast<uint64_t>(pps))
+                            : std::string{"max"})
+              << " pps\n";
+
+    std::random_device seed{};
+    std::mt19937_64 rng{(static_cast<uint64_t>(seed()) << 32) | seed()};
+    std::uniform_int_distribution<size_t> sizes{min_size, max_size};
+    probe::Header hdr{};
+    hdr.stream = static_cast<uint32_t>(rng());
+
+    // Send time of datagram id (counting from 0), until its TX timestamp
+    // comes back. A slot may have been reused by then; the id says.
+    struct SentAt {
+        uint32_t id{0};
+        uint64_t ns{0};
+    };
+    std::vector<SentAt> sent_at(opts.tx_timestamps ? (1 << 16) : 0);
+    uint32_t next_id{0};
+    histogram::Histogram tx_latency{};
+    const auto read_tx_timestamps = [&]() {
+#ifdef SO_TIMESTAMPING
+        if (not opts.tx_timestamps) return;
+        socket::read_tx_timestamps(s,
+                [&](uint32_t id, const struct timespec& when) {
+                    const uint64_t tx_ns{
+                            static_cast<uint64_t>(when.tv_sec) * 1'000'000'000 +
+                            static_cast<uint64_t>(when.tv_nsec)};
+                    const auto& stamped{sent_at[id % sent_at.size()]};
+                    if (stamped.id == id && tx_ns >= stamped.ns) {
+                        histogram::record(tx_latency, tx_ns - stamped.ns);
+                    }
+                });
+#endif
+    };
+
+    socket::MsgBatch batch{io_opts.batch_size};
+    SendStats stats{};
+    const uint64_t start{pace::now_ns()};
+    const uint64_t end{(opts.duration_s > 0)
+            ? start + static_cast<uint64_t>(opts.duration_s * 1e9) : 0};
+    while (not stop.load(std::memory_order_relaxed) &&
+           (end == 0 || pace::now_ns() < end)) {
+        if (interval_ns > 0) {
+            pace::until(start + static_cast<uint64_t>(
+                    static_cast<double>(hdr.seq) * interval_ns));
+        }
+
+        // Sequence numbers are only used up by datagrams that were sent:
+        // whatever a send leaves behind is staged again, with the same
+        // numbers, next time round. A send that fails locally must not
+        // look like loss on the network to the receiver.
+        const uint64_t tx_ns{pace::now_ns(CLOCK_REALTIME)};
+        probe::Header staged{hdr};
+        for (size_t i = 0; i < batch.size(); i++) {
+            staged.tx_ns = tx_ns;
+            probe::encode(batch.msgs[i].pckt, staged);
+            batch.lens[i] = sizes(rng);
+            staged.seq++;
+        }
+
+        size_t sent{0};
+        if (batch.size() == 1) {
+            const auto rval = socket::sendmsg(s, batch.msgs[0], batch.lens[0]);
+            if (ok(rval)) {
+                sent = 1;
+            } else {
+                stats.failure(get_error(rval));
+            }
+        } else {
+            const auto rval = socket::sendmmsg(s, batch, batch.size());
+            if (ok(rval)) {
+                sent = get_valueref_unsafe(rval);
+            } else {
+                stats.failure(get_error(rval));
+            }
+        }
+        hdr.seq += sent;
+
+        size_t bytes{0};
+        for (size_t i = 0; i < sent; i++) {
+            bytes += batch.lens[i];
+        }
+        if (opts.tx_timestamps) {
+            for (size_t i = 0; i < sent; i++, next_id++) {
+                sent_at[next_id % sent_at.size()] = {next_id, tx_ns};
+            }
+        }
+        read_tx_timestamps();
+        if (sent > 0) stats.record(sent, bytes);
+        stats.maybe_report(std::cerr);
+    }
+    stats.report(std::cerr);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    read_tx_timestamps();
+    if (tx_latency.total > 0) {
+        std::cerr << "send to device: " << histogram::summary_us(tx_latency)
+                  << "\n";
+    }
+}
+
+// Turn SIGINT/SIGTERM into an orderly shutdown: on_signal() runs on a
+// thread of its own while everything else carries on. Must be called
+// before any other thread is started, so that they all inherit the mask.
+void handleSignals(std::function<void()> on_signal) {
+    sigset_t set{};
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    std::thread{[set, on_signal]() {
+        int sig{0};
+        sigwait(&set, &sig);
+        on_signal();
+    }}.detach();
+}
+
+// "100", "1.5k", "10M", "1G"
+double parse_rate(const char* arg) {
+    char* end{nullptr};
+    double rate{std::strtod(arg, &end)};
+    switch (*end) {
+        case 'k': case 'K': rate *= 1e3; end++; break;
+        case 'm': case 'M': rate *= 1e6; end++; break;
+        case 'g': case 'G': rate *= 1e9; end++; break;
+        default: break;
+    }
+    return (end == arg || *end != '\0') ? -1 : rate;
+}
+
 int main(int argc, char * argv[]) {
     auto mc_dest_or{socket::from_string("239.255.255.251")};
     in_port_t port = 10101;
     int ttl = 1;
     int mtu = 1500;
     Mode mode{Mode::LISTEN};
+    struct IOOpts io_opts{};
+    std::string pcap_path{};
+    pcapng::Rotation rotation{};
+    struct ReplayOpts replay_opts{};
+    struct GenerateOpts generate_opts{};
+    bool analyze{false};
+    size_t top_sources{0};
+    std::string metrics_endpoint{};
+    int metrics_interval_s{0};
+    std::string filter_expr{};
+    std::vector<match::Pattern> patterns{};
+    struct LatencyOpts latency{};
 
     int ch{-1};
-    while ((ch = getopt(argc, argv, "cg:hlm:p:t:?")) != -1) {
+    while ((ch = getopt(argc, argv, "ab:BcC:d:D:e:E:f:F:g:G:hi:j:KlL:m:M:n:N:p:Pq:Q:r:Rs:St:T:w:x:Xy:Z?")) != -1) {
         switch (ch) {
+            case 'a':
+                analyze = true;
+                break;
+            case 'b': {
+                const int specified_batch{atoi(optarg)};
+                if (specified_batch > 0 && specified_batch <= 1024) {
+                    io_opts.batch_size = specified_batch;
+                } else {
+                    std::cerr << "specified batch size invalid or out of range\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'B':
+                latency.spin = false;
+                break;
             case 'c':
                 mode = Mode::CLIENT;
                 break;
+            case 'C': {
+                const int specified_mb{atoi(optarg)};
+                if (specified_mb > 0) {
+                    rotation.max_bytes = static_cast<uint64_t>(specified_mb)
+                                         << 20;
+                } else {
+                    std::cerr << "specified file size invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'd': {
+                const auto format_or{framing::parse(optarg)};
+                if (ok(format_or)) {
+                    io_opts.framing = get_valueref_unsafe(format_or);
+                } else {
+                    std::cerr << "unknown framing: " << optarg << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'D': {
+                const double specified_duration{atof(optarg)};
+                if (specified_duration > 0) {
+                    generate_opts.duration_s = specified_duration;
+                } else {
+                    std::cerr << "specified duration invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'e':
+                if (std::string{optarg} == "syscall") {
+                    io_opts.engine = Engine::SYSCALL;
+                } else if (std::string{optarg} == "uring") {
+                    io_opts.engine = Engine::URING;
+                } else {
+                    std::cerr << "unknown I/O engine: " << optarg << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'E': {
+                std::string complaint{};
+                const auto e{match::add(patterns, optarg, complaint)};
+                if (not error::ok(e)) {
+                    std::cerr << "-E: " << complaint << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'f':
+                filter_expr = optarg;
+                break;
+            case 'F': {
+                const int specified_top{atoi(optarg)};
+                if (specified_top > 0) {
+                    top_sources = specified_top;
+                } else {
+                    std::cerr << "specified number of sources invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
             case 'g':
                 mc_dest_or = socket::from_string(optarg);
                 break;
+            case 'G': {
+                const int specified_secs{atoi(optarg)};
+                if (specified_secs > 0) {
+                    rotation.max_age = std::chrono::seconds(specified_secs);
+                } else {
+                    std::cerr << "specified rotation interval invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
             case 'h':
             case '?':
                 usage(argv[0]);
                 exit(EXIT_SUCCESS);
                 break;
+            case 'i': {
+                const int specified_interval{atoi(optarg)};
+                if (specified_interval > 0) {
+                    metrics_interval_s = specified_interval;
+                } else {
+                    std::cerr << "specified metrics interval invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'j': {
+                const int specified_threads{atoi(optarg)};
+                if (specified_threads > 0 && specified_threads <= 256) {
+                    io_opts.threads = specified_threads;
+                } else {
+                    std::cerr << "specified thread count invalid or out of range\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
             case 'l':
                 mode = Mode::LISTEN;
                 break;
+            case 'L': {
+                const int specified_cpu{atoi(optarg)};
+                if (specified_cpu >= 0) {
+                    latency.cpu = specified_cpu;
+                } else {
+                    std::cerr << "specified CPU invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
             case 'm': {
                 const int specified_mtu{atoi(optarg)};
                 if (specified_mtu > 0 && specified_mtu <= 1500) {
@@ -240,6 +1651,21 @@ int main(int argc, char * argv[]) {
                 }
                 break;
             }
+            case 'M':
+                metrics_endpoint = optarg;
+                break;
+            case 'n':
+            case 'N': {
+                const double specified_rate{parse_rate(optarg)};
+                if (specified_rate < 0) {
+                    std::cerr << "specified rate invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                mode = Mode::GENERATE;
+                (ch == 'n' ? generate_opts.pps : generate_opts.bps) =
+                        specified_rate;
+                break;
+            }
             case 'p': {
                 const int specified_port{atoi(optarg)};
                 if (specified_port > 0 && specified_port <= 0xffff) {
@@ -250,6 +1676,58 @@ int main(int argc, char * argv[]) {
                 }
                 break;
             }
+            case 'P':
+                mode = Mode::CAPTURE;
+                break;
+            case 'q': {
+                const int specified_depth{atoi(optarg)};
+                if (specified_depth >= 0 && specified_depth <= (1 << 20)) {
+                    io_opts.queue_depth = specified_depth;
+                } else {
+                    std::cerr << "specified queue depth invalid or out of range\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'Q':
+                if (std::string{optarg} == "block") {
+                    io_opts.overflow = ring::Overflow::BLOCK;
+                } else if (std::string{optarg} == "drop-newest") {
+                    io_opts.overflow = ring::Overflow::DROP_NEWEST;
+                } else if (std::string{optarg} == "drop-oldest") {
+                    io_opts.overflow = ring::Overflow::DROP_OLDEST;
+                } else {
+                    std::cerr << "unknown queue policy: " << optarg << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                mode = Mode::REPLAY;
+                replay_opts.path = optarg;
+                break;
+            case 'R':
+                io_opts.gro = true;
+                break;
+            case 's': {
+                char* end{nullptr};
+                const long specified_min{std::strtol(optarg, &end, 10)};
+                long specified_max{specified_min};
+                if (*end == '-') {
+                    specified_max = std::strtol(end + 1, &end, 10);
+                }
+                if (*end == '\0' && specified_min > 0 &&
+                    specified_max >= specified_min) {
+                    generate_opts.min_size = specified_min;
+                    generate_opts.max_size = specified_max;
+                } else {
+                    std::cerr << "specified payload size invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'S':
+                io_opts.gso = true;
+                break;
             case 't': {
                 const int specified_ttl{atoi(optarg)};
                 if (specified_ttl > 0 && specified_ttl <= 0xff) {
@@ -260,6 +1738,48 @@ int main(int argc, char * argv[]) {
                 }
                 break;
             }
+            case 'T': {
+                const int specified_timeout{atoi(optarg)};
+                if (specified_timeout >= 0) {
+                    io_opts.batch_timeout_ms = specified_timeout;
+                } else {
+                    std::cerr << "specified batch timeout invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'w':
+                pcap_path = optarg;
+                break;
+            case 'x': {
+                const double specified_speed{atof(optarg)};
+                if (specified_speed >= 0) {
+                    replay_opts.speed = specified_speed;
+                } else {
+                    std::cerr << "specified replay speed invalid\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'K':
+                generate_opts.tx_timestamps = true;
+                break;
+            case 'X':
+                replay_opts.txtime = true;
+                break;
+            case 'y': {
+                const int specified_priority{atoi(optarg)};
+                if (specified_priority >= 1 && specified_priority <= 99) {
+                    latency.fifo_priority = specified_priority;
+                } else {
+                    std::cerr << "specified priority invalid or out of range\n";
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'Z':
+                io_opts.zerocopy = true;
+                break;
             default:
                 usage(argv[0]);
                 exit(EXIT_FAILURE);
@@ -278,6 +1798,135 @@ int main(int argc, char * argv[]) {
     mtu = adjust_mtu(mtu, mc_dest.ss_family);
     std::cerr << "application-layer MTU: " << mtu << "\n";
 
+    if (generate_opts.tx_timestamps && mode != Mode::GENERATE) {
+        std::cerr << "-K applies to generate mode only\n";
+        exit(EXIT_FAILURE);
+    }
+    if (pcap_path.empty() &&
+        (rotation.max_bytes > 0 || rotation.max_age.count() > 0)) {
+        std::cerr << "-C and -G need -w\n";
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef __linux__
+    bpf::Program filter_prog{};
+#endif
+    if (not filter_expr.empty()) {
+        // With UDP_GRO the filter would see whole coalesced trains.
+        if (mode != Mode::LISTEN || io_opts.gro) {
+            std::cerr << "-f applies to listen mode only, without -R\n";
+            exit(EXIT_FAILURE);
+        }
+#ifdef __linux__
+        std::string complaint{};
+        auto filter_or{filter::compile(filter_expr, mc_dest.ss_family,
+                                       complaint)};
+        if (not ok(filter_or)) {
+            std::cerr << "filter: " << complaint << "\n";
+            exit(EXIT_FAILURE);
+        }
+        filter_prog = std::move(get_valueref_unsafe(filter_or));
+#else
+        std::cerr << "-f is not supported on this platform\n";
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+    Sink sink{std::cout};
+    Output out{sink};
+    out.port = port;
+    std::atomic<bool> stop{false};
+    std::unique_ptr<probe::Analyzer> analyzer{};
+    std::unique_ptr<flowtable::Flows> flows{};
+    std::unique_ptr<pcapng::Writer> pcap{};
+    const bool receiving{mode == Mode::LISTEN || mode == Mode::CAPTURE};
+    if (receiving) {
+        // Final words: the analysis so far, and whatever was buffered.
+        handleSignals([&sink, &analyzer, &flows, &pcap, top_sources]() {
+            if (analyzer != nullptr) {
+                write(sink, probe::report(*analyzer));
+            }
+            if (flows != nullptr) {
+                write(sink, flowtable::top(*flows, top_sources));
+            }
+            if (pcap != nullptr) {
+                pcapng::sync(*pcap);
+            }
+            std::lock_guard<std::mutex> lock{sink.mtx};
+            sink.os.flush();
+            std::_Exit(EXIT_SUCCESS);
+        });
+    } else if (mode == Mode::GENERATE) {
+        handleSignals([&stop]() { stop = true; });
+    }
+    match::Matcher matcher{};
+    if (receiving && not patterns.empty()) {
+        matcher = match::build(std::move(patterns));
+        out.matcher = &matcher;
+        std::cerr << "matching " << matcher.patterns.size() << " patterns\n";
+    }
+    if (receiving && not pcap_path.empty()) {
+        auto pcap_or{pcapng::open(pcap_path, mc_dest, rotation)};
+        if (not ok(pcap_or)) {
+            std::cerr << pcap_path << ": " << to_string(pcap_or) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        pcap = std::move(get_valueref_unsafe(pcap_or));
+        out.pcap = pcap.get();
+        std::cerr << "writing pcapng to " << pcap_path << "\n";
+    }
+    if (receiving && analyze) {
+        analyzer = std::make_unique<probe::Analyzer>();
+        out.analyzer = analyzer.get();
+        std::thread{[&analyzer = *analyzer, &sink]() {
+            while (true) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                const auto text{probe::report(analyzer)};
+                if (not text.empty()) write(sink, text);
+            }
+        }}.detach();
+    }
+    if (receiving && top_sources > 0) {
+        flows = std::make_unique<flowtable::Flows>();
+        out.flows = flows.get();
+        std::thread{[&flows = *flows, &sink, top_sources]() {
+            while (true) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                flowtable::expire(flows);
+                write(sink, flowtable::top(flows, top_sources));
+            }
+        }}.detach();
+    }
+    std::unique_ptr<ring::Ring<Received>> queue{};
+    if (receiving && io_opts.queue_depth > 0) {
+        queue = std::make_unique<ring::Ring<Received>>(io_opts.queue_depth,
+                                                       io_opts.overflow);
+        out.queue = queue.get();
+        metrics::watch(queue->counters);
+        std::thread{runFormatter, std::ref(out)}.detach();
+    }
+    metrics::Exporter exporter{};
+    if (not metrics_endpoint.empty() || metrics_interval_s > 0) {
+        const std::chrono::seconds interval{
+                (metrics_interval_s > 0) ? metrics_interval_s : 1};
+        std::thread{metrics::aggregate, std::ref(exporter), interval,
+                    metrics_interval_s > 0, std::ref(std::cerr)}.detach();
+    }
+    std::unique_ptr<socket::Socket> metrics_listener{};
+    if (not metrics_endpoint.empty()) {
+        auto listener_or{metrics::listen_on(metrics_endpoint)};
+        if (not ok(listener_or)) {
+            std::cerr << "metrics: " << metrics_endpoint << ": "
+                      << to_string(listener_or) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        metrics_listener = std::make_unique<socket::Socket>(
+                std::move(get_valueref_unsafe(listener_or)));
+        std::thread{metrics::serve, std::ref(*metrics_listener),
+                    std::ref(exporter)}.detach();
+        std::cerr << "serving metrics on " << metrics_endpoint << "\n";
+    }
+
     auto socket_or{socket::makeForFamily(mc_dest.ss_family)};
     if (not ok(socket_or)) {
         std::cerr << to_string(socket_or);
@@ -287,24 +1936,55 @@ int main(int argc, char * argv[]) {
 
     switch (mode) {
         case Mode::LISTEN: {
-            const struct MulticastOpts opts{mc_dest};
+            struct MulticastOpts opts{mc_dest, 1, io_opts.gro};
+            if (latency.cpu >= 0) {
+                if (io_opts.threads > 1 || io_opts.batch_size > 1 ||
+                    io_opts.engine == Engine::URING) {
+                    std::cerr << "-L cannot be combined with -j, -b or "
+                              << "-e uring\n";
+                    exit(EXIT_FAILURE);
+                }
+                if (latency.spin) opts.busy_poll_us = kBusyPollUs;
+            } else if (not latency.spin || latency.fifo_priority > 0) {
+                std::cerr << "-B and -y need -L\n";
+                exit(EXIT_FAILURE);
+            }
+
+            if (io_opts.threads > 1) {
+#ifdef __linux__
+                runListenThreads(opts, io_opts, filter_prog, out);
+#else
+                std::cerr << "-j is not supported on this platform\n";
+                exit(EXIT_FAILURE);
+#endif
+                break;
+            }
 
+#ifdef __linux__
+            // Before joining, so nothing unfiltered is ever queued.
+            if (not filter_prog.empty()) {
+                const auto e{bpf::attach(s, filter_prog)};
+                if (not error::ok(e)) {
+                    std::cerr << "filter: " << error::to_string(e) << "\n";
+                    exit(EXIT_FAILURE);
+                }
+            }
+#endif
             auto e = prepareListenSocket(s, opts);
             if (not error::ok(e)) {
                 std::cerr << error::to_string(e);
                 exit(EXIT_FAILURE);
             }
+            if (latency.cpu >= 0) {
+                std::cerr << "listening on CPU " << latency.cpu
+                          << (latency.spin ? ", busy-polling" : ", blocking")
+                          << "...\n";
+                runListenLowLatency(s, io_opts, latency, out);
+                break;
+            }
             std::cerr << "listening...\n";
 
-            socket::Msg msg{};
-            while (true) {
-                const auto rval = socket::recvmsg(s, msg);
-                if (not ok(rval)) {
-                    std::cerr << to_string(rval);
-                }
-
-                std::cout << describe(msg, get_valueref_unsafe(rval)) << "\n";
-            }
+            runListen(s, io_opts, out);
             break;
         }
 
@@ -318,19 +1998,70 @@ int main(int argc, char * argv[]) {
             }
             std::cerr << "copying from stdin to multicast sendmsg\n";
 
-            socket::Msg msg{};
-            while (true) {
-                const auto consumed{fread(msg.pckt, 1, mtu, stdin)};
-                if (consumed == 0) {
-                    break;
-                }
-                const auto rval = socket::sendmsg(s, msg, consumed);
-                if (not ok(rval)) {
-                    std::cerr << to_string(rval);
+            if (io_opts.framing) {
+                if (io_opts.zerocopy || io_opts.gso) {
+                    std::cerr << "-d cannot be combined with -S or -Z\n";
+                    exit(EXIT_FAILURE);
                 }
+                runClientFramed(s, mtu, io_opts);
+            } else if (io_opts.zerocopy) {
+#ifdef MCAST_HAVE_ZEROCOPY
+                runClientZerocopy(s, mtu, mc_dest.ss_family, io_opts.gso);
+#else
+                std::cerr << "MSG_ZEROCOPY is not supported on this platform\n";
+                exit(EXIT_FAILURE);
+#endif
+            } else if (io_opts.gso) {
+#ifdef UDP_SEGMENT
+                runClientGso(s, mtu, mc_dest.ss_family);
+#else
+                std::cerr << "UDP GSO is not supported on this platform\n";
+                exit(EXIT_FAILURE);
+#endif
+            } else {
+                runClient(s, mtu, io_opts);
+            }
+            break;
+        }
+
+        case Mode::GENERATE: {
+            const struct MulticastOpts opts{mc_dest, ttl, false,
+                                            generate_opts.tx_timestamps};
+
+            auto e = prepareClientSocket(s, opts);
+            if (not error::ok(e)) {
+                std::cerr << error::to_string(e);
+                exit(EXIT_FAILURE);
+            }
+
+            runGenerate(s, mtu, mc_dest.ss_family, io_opts, generate_opts,
+                        stop);
+            break;
+        }
 
-                std::cerr << "sent " << consumed << " bytes\n";
+        case Mode::REPLAY: {
+            const struct MulticastOpts opts{mc_dest, ttl};
+
+            auto e = prepareClientSocket(s, opts);
+            if (not error::ok(e)) {
+                std::cerr << error::to_string(e);
+                exit(EXIT_FAILURE);
             }
+            std::cerr << "replaying " << replay_opts.path << "\n";
+
+            runReplay(s, replay_opts);
+            break;
+        }
+
+        case Mode::CAPTURE: {
+#ifdef MCAST_HAVE_PACKET
+            std::cerr << "capturing with " << io_opts.threads
+                      << " thread(s)...\n";
+            runCapture(mc_dest, io_opts.threads, out);
+#else
+            std::cerr << "packet capture is not supported on this platform\n";
+            exit(EXIT_FAILURE);
+#endif
             break;
         }
     }
@@ -0,0 +1,553 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_MATCH_H
+#define MCAST_MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cerrno>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "error.h"
+
+namespace mcast {
+namespace match {
+
+// Many payload patterns searched for at once. Each pattern is a fixed
+// length sequence of byte sets:
+//
+//     hex:6d63??74     hex bytes; ?? is any byte; spaces are ignored
+//     re:GET /\d{3}    regex-lite: literal bytes, . \d \w \s \xHH \. etc,
+//                      [a-z0-9] and [^...] classes, and {n} repeats
+//     anything else    the literal bytes; "ascii:" forces this reading
+//
+// The longest run of single bytes in each pattern is its anchor. One
+// Aho-Corasick automaton finds every anchor in one pass, and each hit is
+// checked against the whole pattern around it. While the automaton is at
+// its root, a SIMD scan skips ahead to the next byte that can start an
+// anchor, which is most of a packet for most pattern sets.
+using ByteSet = std::bitset<256>;
+
+struct Pattern {
+    std::string text{};  // as given
+    std::vector<ByteSet> atoms{};
+    size_t anchor{0};  // offset of the anchor in atoms
+    size_t anchor_len{0};
+};
+
+struct Matcher {
+    std::vector<Pattern> patterns{};
+
+    // The automaton, over byte classes: every byte that occurs in no
+    // anchor is class 0.
+    std::array<uint16_t, 256> classes{};
+    size_t nclasses{1};
+    // Each entry is the next state's row, state * nclasses, with
+    // kOutput set if some anchor ends there.
+    std::vector<uint32_t> next{};  // [state * nclasses + class]
+    // Patterns whose anchor ends on entering each state: out[out_begin[s]]
+    // up to out[out_begin[s + 1]].
+    std::vector<uint32_t> out_begin{};
+    std::vector<uint32_t> out{};
+
+    // Bytes that leave the root, as a table and as nibble masks for the
+    // SIMD scan: byte b may start an anchor if lo[b & 15] & hi[b >> 4].
+    std::array<bool, 256> starts{};
+    alignas(16) uint8_t lo[16]{};
+    alignas(16) uint8_t hi[16]{};
+    uint8_t few[4]{};  // or, where there are at most 4 such bytes, them
+    size_t nfew{0};
+};
+
+constexpr uint32_t kOutput{uint32_t{1} << 31};
+
+// A pattern found in a datagram.
+struct Match {
+    uint32_t pattern{0};
+    uint32_t offset{0};
+    uint32_t len{0};
+};
+
+namespace {
+
+inline ByteSet single(uint8_t b) {
+    ByteSet set{};
+    set.set(b);
+    return set;
+}
+
+inline int hex_value(char c) noexcept {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline bool parse_hex(const std::string& text, std::vector<ByteSet>& atoms) {
+    std::string digits{};
+    for (const char c : text) {
+        if (c != ' ') digits.push_back(c);
+    }
+    if (digits.empty() || digits.size() % 2 != 0) return false;
+    for (size_t i = 0; i < digits.size(); i += 2) {
+        if (digits[i] == '?' && digits[i + 1] == '?') {
+            atoms.push_back(ByteSet{}.set());
+            continue;
+        }
+        const int h{hex_value(digits[i])};
+        const int l{hex_value(digits[i + 1])};
+        if (h < 0 || l < 0) return false;
+        atoms.push_back(single(static_cast<uint8_t>(h * 16 + l)));
+    }
+    return true;
+}
+
+// The byte set named by the escape at text[i] (just past the backslash),
+// advancing i past it.
+inline bool parse_escape(const std::string& text, size_t& i, ByteSet& set) {
+    if (i >= text.size()) return false;
+    const char c{text[i++]};
+    switch (c) {
+        case 'd':
+            for (int b = '0'; b <= '9'; b++) set.set(b);
+            return true;
+        case 'w':
+            for (int b = 0; b < 256; b++) {
+                if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') ||
+                    (b >= 'A' && b <= 'Z') || b == '_') {
+                    set.set(b);
+                }
+            }
+            return true;
+        case 's':
+            for (const char s : {' ', '\t', '\n', '\r', '\f', '\v'}) {
+                set.set(static_cast<uint8_t>(s));
+            }
+            return true;
+        case 'n': set.set('\n'); return true;
+        case 'r': set.set('\r'); return true;
+        case 't': set.set('\t'); return true;
+        case '0': set.set(0); return true;
+        case 'x': {
+            if (i + 2 > text.size()) return false;
+            const int h{hex_value(text[i])};
+            const int l{hex_value(text[i + 1])};
+            if (h < 0 || l < 0) return false;
+            i += 2;
+            set.set(static_cast<size_t>(h * 16 + l));
+            return true;
+        }
+        default:
+            set.set(static_cast<uint8_t>(c));  // \. \[ \\ and the like
+            return true;
+    }
+}
+
+// The byte set of the [...] class at text[i] (just past the '['),
+// advancing i past its ']'.
+inline bool parse_class(const std::string& text, size_t& i, ByteSet& set) {
+    bool negate{false};
+    if (i < text.size() && text[i] == '^') {
+        negate = true;
+        i++;
+    }
+    bool first{true};
+    while (i < text.size() && (text[i] != ']' || first)) {
+        first = false;
+        ByteSet member{};
+        if (text[i] == '\\') {
+            i++;
+            if (not parse_escape(text, i, member)) return false;
+        } else {
+            member.set(static_cast<uint8_t>(text[i++]));
+        }
+        if (member.count() == 1 && i + 1 < text.size() && text[i] == '-' &&
+            text[i + 1] != ']') {
+            size_t lo{0};
+            while (not member.test(lo)) lo++;
+            size_t hi_i{i + 1};
+            size_t hi{static_cast<uint8_t>(text[hi_i])};
+            if (text[hi_i] == '\\') {
+                hi_i++;
+                ByteSet end{};
+                if (not parse_escape(text, hi_i, end) || end.count() != 1) {
+                    return false;
+                }
+                hi = 0;
+                while (not end.test(hi)) hi++;
+                i = hi_i;
+            } else {
+                i = hi_i + 1;
+            }
+            if (hi < lo) return false;
+            for (size_t b = lo; b <= hi; b++) member.set(b);
+        }
+        set |= member;
+    }
+    if (i >= text.size()) return false;  // no closing ]
+    i++;
+    if (negate) set.flip();
+    return true;
+}
+
+inline bool parse_regex(const std::string& text, std::vector<ByteSet>& atoms) {
+    size_t i{0};
+    while (i < text.size()) {
+        ByteSet set{};
+        const char c{text[i++]};
+        if (c == '.') {
+            set.set();
+        } else if (c == '\\') {
+            if (not parse_escape(text, i, set)) return false;
+        } else if (c == '[') {
+            if (not parse_class(text, i, set)) return false;
+        } else {
+            set.set(static_cast<uint8_t>(c));
+        }
+
+        size_t repeat{1};
+        if (i < text.size() && text[i] == '{') {
+            char* end{nullptr};
+            const unsigned long n{std::strtoul(text.c_str() + i + 1, &end, 10)};
+            if (*end != '}' || n == 0 || n > 0xffff) return false;
+            repeat = n;
+            i = static_cast<size_t>(end - text.c_str()) + 1;
+        }
+        atoms.insert(atoms.end(), repeat, set);
+    }
+    return not atoms.empty();
+}
+
+// Set the pattern's anchor to its longest run of single bytes.
+inline bool choose_anchor(Pattern& p) {
+    size_t run{0};
+    for (size_t i = 0; i < p.atoms.size(); i++) {
+        run = (p.atoms[i].count() == 1) ? run + 1 : 0;
+        if (run > p.anchor_len) {
+            p.anchor_len = run;
+            p.anchor = i + 1 - run;
+        }
+    }
+    return p.anchor_len > 0;
+}
+
+inline uint8_t only_byte(const ByteSet& set) noexcept {
+    size_t b{0};
+    while (not set.test(b)) b++;
+    return static_cast<uint8_t>(b);
+}
+
+}  // namespace
+
+// Parse one pattern; on EINVAL, complaint says why.
+inline ErrorOr<Pattern> parse(const std::string& text,
+                              std::string& complaint) {
+    Pattern p{text};
+    bool valid{false};
+    if (text.rfind("hex:", 0) == 0) {
+        valid = parse_hex(text.substr(4), p.atoms);
+    } else if (text.rfind("re:", 0) == 0) {
+        valid = parse_regex(text.substr(3), p.atoms);
+    } else {
+        const std::string literal{
+                (text.rfind("ascii:", 0) == 0) ? text.substr(6) : text};
+        for (const char c : literal) {
+            p.atoms.push_back(single(static_cast<uint8_t>(c)));
+        }
+        valid = not p.atoms.empty();
+    }
+    if (not valid) {
+        complaint = "cannot parse pattern '" + text + "'";
+        return error::Error{EINVAL};
+    }
+    if (not choose_anchor(p)) {
+        complaint = "pattern '" + text + "' needs at least one exact byte";
+        return error::Error{EINVAL};
+    }
+    return p;
+}
+
+// Patterns from a -E argument: one pattern, or "@file" for one per line
+// of file (blank lines and lines starting with # are skipped).
+inline error::Error add(std::vector<Pattern>& patterns,
+                        const std::string& arg, std::string& complaint) {
+    std::vector<std::string> texts{};
+    if (arg.rfind("@", 0) == 0) {
+        std::ifstream file{arg.substr(1)};
+        if (not file) {
+            complaint = "cannot read " + arg.substr(1);
+            return error::Error{ENOENT};
+        }
+        std::string line{};
+        while (std::getline(file, line)) {
+            if (not line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            texts.push_back(line);
+        }
+    } else {
+        texts.push_back(arg);
+    }
+    for (const auto& text : texts) {
+        auto p_or{parse(text, complaint)};
+        if (not ok(p_or)) return get_error(p_or);
+        patterns.push_back(std::move(get_valueref_unsafe(p_or)));
+    }
+    return error::success();
+}
+
+// Build the automaton for patterns.
+inline Matcher build(std::vector<Pattern> patterns) {
+    Matcher m{};
+    m.patterns = std::move(patterns);
+
+    // The trie of anchors, with a full 256-way table per state while
+    // building.
+    using Row = std::array<int32_t, 256>;
+    std::vector<Row> go(1);
+    go[0].fill(-1);
+    std::vector<std::vector<uint32_t>> outputs(1);
+    for (uint32_t id = 0; id < m.patterns.size(); id++) {
+        const auto& p{m.patterns[id]};
+        size_t state{0};
+        for (size_t i = p.anchor; i < p.anchor + p.anchor_len; i++) {
+            const uint8_t b{only_byte(p.atoms[i])};
+            if (go[state][b] < 0) {
+                go[state][b] = static_cast<int32_t>(go.size());
+                go.emplace_back();
+                go.back().fill(-1);
+                outputs.emplace_back();
+            }
+            state = static_cast<size_t>(go[state][b]);
+        }
+        outputs[state].push_back(id);
+    }
+
+    // Bytes in any anchor each get a class of their own.
+    for (size_t b = 0; b < 256; b++) {
+        for (const auto& row : go) {
+            if (row[b] >= 0) {
+                m.classes[b] = static_cast<uint16_t>(m.nclasses++);
+                break;
+            }
+        }
+    }
+
+    // Failure links, breadth first, turning the trie into a DFA and
+    // gathering each state's outputs with those of its failure state.
+    std::vector<uint32_t> fail(go.size(), 0);
+    std::deque<uint32_t> queue{};
+    for (size_t b = 0; b < 256; b++) {
+        if (go[0][b] < 0) {
+            go[0][b] = 0;
+        } else {
+            queue.push_back(static_cast<uint32_t>(go[0][b]));
+        }
+    }
+    while (not queue.empty()) {
+        const uint32_t s{queue.front()};
+        queue.pop_front();
+        const auto& inherited{outputs[fail[s]]};
+        outputs[s].insert(outputs[s].end(), inherited.begin(), inherited.end());
+        for (size_t b = 0; b < 256; b++) {
+            const int32_t t{go[s][b]};
+            if (t < 0) {
+                go[s][b] = go[fail[s]][b];
+                continue;
+            }
+            fail[t] = static_cast<uint32_t>(go[fail[s]][b]);
+            queue.push_back(static_cast<uint32_t>(t));
+        }
+    }
+
+    // Up to 257 classes: class 0 may be left with no bytes at all.
+    std::vector<uint16_t> representative(m.nclasses);
+    for (size_t b = 256; b-- > 0;) {
+        representative[m.classes[b]] = static_cast<uint16_t>(b);
+    }
+    m.next.resize(go.size() * m.nclasses);
+    m.out_begin.reserve(go.size() + 1);
+    for (size_t s = 0; s < go.size(); s++) {
+        for (size_t c = 0; c < m.nclasses; c++) {
+            const auto t{static_cast<size_t>(go[s][representative[c]])};
+            m.next[s * m.nclasses + c] =
+                    static_cast<uint32_t>(t * m.nclasses) |
+                    (outputs[t].empty() ? 0 : kOutput);
+        }
+        m.out_begin.push_back(static_cast<uint32_t>(m.out.size()));
+        m.out.insert(m.out.end(), outputs[s].begin(), outputs[s].end());
+    }
+    m.out_begin.push_back(static_cast<uint32_t>(m.out.size()));
+
+    for (size_t b = 0; b < 256; b++) {
+        if (go[0][b] == 0) continue;
+        m.starts[b] = true;
+        // Bucket by high nibble mod 8: only bytes 0x80 apart collide.
+        m.lo[b & 15] |= static_cast<uint8_t>(1u << ((b >> 4) & 7));
+        m.hi[b >> 4] |= static_cast<uint8_t>(1u << ((b >> 4) & 7));
+        if (m.nfew < sizeof(m.few)) m.few[m.nfew] = static_cast<uint8_t>(b);
+        m.nfew++;
+    }
+    return m;
+}
+
+namespace {
+
+// The first i' >= i at which data[i'] may start an anchor, or len.
+inline size_t skip(const Matcher& m, const uint8_t* data, size_t i,
+                   size_t len) noexcept {
+    if (i < len && m.starts[data[i]]) return i;
+#if defined(__AVX2__) || defined(__SSSE3__)
+    const __m128i lo{_mm_load_si128(reinterpret_cast<const __m128i*>(m.lo))};
+    const __m128i hi{_mm_load_si128(reinterpret_cast<const __m128i*>(m.hi))};
+    const __m128i nibble{_mm_set1_epi8(0x0f)};
+#ifdef __AVX2__
+    const __m256i lo2{_mm256_broadcastsi128_si256(lo)};
+    const __m256i hi2{_mm256_broadcastsi128_si256(hi)};
+    const __m256i nibble2{_mm256_set1_epi8(0x0f)};
+    for (; i + 32 <= len; i += 32) {
+        const __m256i v{_mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(data + i))};
+        const __m256i hit{_mm256_and_si256(
+                _mm256_shuffle_epi8(lo2, _mm256_and_si256(v, nibble2)),
+                _mm256_shuffle_epi8(hi2, _mm256_and_si256(
+                        _mm256_srli_epi16(v, 4), nibble2)))};
+        uint32_t mask{~static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(hit, _mm256_setzero_si256())))};
+        while (mask != 0) {
+            const size_t at{i + static_cast<size_t>(__builtin_ctz(mask))};
+            if (m.starts[data[at]]) return at;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + 16 <= len; i += 16) {
+        const __m128i v{_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data + i))};
+        const __m128i hit{_mm_and_si128(
+                _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble)),
+                _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4),
+                                                   nibble)))};
+        uint32_t mask{~static_cast<uint32_t>(_mm_movemask_epi8(
+                _mm_cmpeq_epi8(hit, _mm_setzero_si128()))) & 0xffff};
+        while (mask != 0) {
+            const size_t at{i + static_cast<size_t>(__builtin_ctz(mask))};
+            if (m.starts[data[at]]) return at;
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    // Without a byte shuffle, only a handful of bytes can be compared
+    // against at once.
+    if (m.nfew > 0 && m.nfew <= sizeof(m.few)) {
+        __m128i wanted[sizeof(m.few)];
+        for (size_t k = 0; k < sizeof(m.few); k++) {
+            wanted[k] = _mm_set1_epi8(static_cast<char>(
+                    m.few[std::min(k, m.nfew - 1)]));
+        }
+        for (; i + 16 <= len; i += 16) {
+            const __m128i v{_mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(data + i))};
+            const __m128i hit{_mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, wanted[0]),
+                                 _mm_cmpeq_epi8(v, wanted[1])),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, wanted[2]),
+                                 _mm_cmpeq_epi8(v, wanted[3])))};
+            const int mask{_mm_movemask_epi8(hit)};
+            if (mask != 0) return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+#endif
+    while (i < len && not m.starts[data[i]]) i++;
+    return i;
+}
+
+inline bool verify(const Pattern& p, const uint8_t* data, size_t len,
+                   size_t start) noexcept {
+    if (start + p.atoms.size() > len) return false;
+    for (size_t k = 0; k < p.atoms.size(); k++) {
+        if (k >= p.anchor && k < p.anchor + p.anchor_len) continue;
+        if (not p.atoms[k].test(data[start + k])) return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+// Call fn(Match) for each occurrence of each pattern in len bytes at
+// data, in order of where the anchor ends, until fn returns false.
+template<typename Fn>
+inline void scan(const Matcher& m, const uint8_t* data, size_t len, Fn&& fn) {
+    if (m.patterns.empty()) return;
+    uint32_t row{0};
+    size_t i{0};
+    while (i < len) {
+        if (row == 0) {
+            i = skip(m, data, i, len);
+            if (i == len) break;
+        }
+        const uint32_t next{m.next[row + m.classes[data[i++]]]};
+        row = next & ~kOutput;
+        if ((next & kOutput) == 0) continue;
+
+        const uint32_t state{row / static_cast<uint32_t>(m.nclasses)};
+        for (uint32_t o = m.out_begin[state]; o < m.out_begin[state + 1]; o++) {
+            const uint32_t id{m.out[o]};
+            const auto& p{m.patterns[id]};
+            const size_t anchor_start{i - p.anchor_len};
+            if (anchor_start < p.anchor) continue;
+            const size_t start{anchor_start - p.anchor};
+            if (not verify(p, data, len, start)) continue;
+            if (not fn(Match{id, static_cast<uint32_t>(start),
+                             static_cast<uint32_t>(p.atoms.size())})) {
+                return;
+            }
+        }
+    }
+}
+
+inline bool any(const Matcher& m, const uint8_t* data, size_t len) {
+    bool found{false};
+    scan(m, data, len, [&found](const Match&) {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+// Every match, up to max, into matches (replacing its contents).
+inline void all(const Matcher& m, const uint8_t* data, size_t len,
+                std::vector<Match>& matches, size_t max = 64) {
+    matches.clear();
+    scan(m, data, len, [&matches, max](const Match& found) {
+        matches.push_back(found);
+        return matches.size() < max;
+    });
+}
+
+}  // namespace match
+}  // namespace mcast
+
+#endif  // MCAST_MATCH_H
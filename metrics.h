@@ -0,0 +1,452 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_METRICS_H
+#define MCAST_METRICS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "error.h"
+#include "ring.h"
+#include "socket.h"
+
+namespace mcast {
+namespace metrics {
+
+// errno values at or above this are counted together in the last slot.
+constexpr size_t kErrnoSlots{134};
+// Batch sizes are counted in power-of-two buckets: 1, 2, 4, ... 1024, more.
+constexpr size_t kBatchBuckets{12};
+
+// One thread's counters. Only that thread writes them, with plain
+// relaxed loads and stores (no locked instructions), and each shard has
+// cache lines of its own; the aggregator only ever reads them.
+struct alignas(64) Shard {
+    std::atomic<uint64_t> rx_datagrams{0};
+    std::atomic<uint64_t> rx_bytes{0};
+    std::atomic<uint64_t> tx_datagrams{0};
+    std::atomic<uint64_t> tx_bytes{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> batched{0};  // datagrams, over all batches
+    std::atomic<uint64_t> batch_sizes[kBatchBuckets]{};
+    std::atomic<uint64_t> kernel_drops{0};  // latest SO_RXQ_OVFL count
+    std::atomic<uint64_t> errors[kErrnoSlots]{};
+};
+
+// Every shard ever handed out; shards outlive their threads so that
+// totals never go backwards.
+struct Registry {
+    std::mutex mtx{};
+    std::vector<std::unique_ptr<Shard>> shards{};
+    const ring::Counters* queue{nullptr};
+};
+
+inline Registry& registry() {
+    static Registry r{};
+    return r;
+}
+
+// The calling thread's shard.
+inline Shard& shard() {
+    thread_local Shard* mine{nullptr};
+    if (mine == nullptr) {
+        auto& r{registry()};
+        std::lock_guard<std::mutex> lock{r.mtx};
+        r.shards.push_back(std::make_unique<Shard>());
+        mine = r.shards.back().get();
+    }
+    return *mine;
+}
+
+namespace {
+
+inline void add(std::atomic<uint64_t>& c, uint64_t n) noexcept {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline size_t batch_bucket(size_t filled) noexcept {
+    if (filled <= 1) return 0;
+    const size_t log2_ceil{static_cast<size_t>(
+            64 - __builtin_clzll(static_cast<uint64_t>(filled) - 1))};
+    return std::min(log2_ceil, kBatchBuckets - 1);
+}
+
+}  // namespace
+
+inline void received(const socket::AuxiliaryData& aux, size_t len) noexcept {
+    auto& s{shard()};
+    add(s.rx_datagrams, 1);
+    add(s.rx_bytes, len);
+    if (socket::has_dropped(aux)) {
+        s.kernel_drops.store(socket::get_dropped(aux),
+                             std::memory_order_relaxed);
+    }
+}
+
+inline void sent(size_t datagrams, size_t bytes) noexcept {
+    auto& s{shard()};
+    add(s.tx_datagrams, datagrams);
+    add(s.tx_bytes, bytes);
+}
+
+inline void batch(size_t filled) noexcept {
+    auto& s{shard()};
+    add(s.batches, 1);
+    add(s.batched, filled);
+    add(s.batch_sizes[batch_bucket(filled)], 1);
+}
+
+inline void count_error(const error::Error& e) noexcept {
+    if (error::ok(e) || e.category != error::Category::ERRNO) return;
+    const size_t slot{std::min(static_cast<size_t>(std::abs(e.num)),
+                               kErrnoSlots - 1)};
+    add(shard().errors[slot], 1);
+}
+
+template<typename T>
+inline void count_error(const ErrorOr<T>& rval) noexcept {
+    count_error(get_error(rval));
+}
+
+// Also export the drop counters of the receive-to-formatter queue.
+inline void watch(const ring::Counters& queue) {
+    auto& r{registry()};
+    std::lock_guard<std::mutex> lock{r.mtx};
+    r.queue = &queue;
+}
+
+// All shards summed at one point in time.
+struct Snapshot {
+    std::chrono::steady_clock::time_point at{};
+    uint64_t rx_datagrams{0};
+    uint64_t rx_bytes{0};
+    uint64_t tx_datagrams{0};
+    uint64_t tx_bytes{0};
+    uint64_t batches{0};
+    uint64_t batched{0};
+    uint64_t batch_sizes[kBatchBuckets]{};
+    uint64_t kernel_drops{0};
+    uint64_t queue_dropped_newest{0};
+    uint64_t queue_dropped_oldest{0};
+    uint64_t queue_blocked{0};
+    uint64_t errors[kErrnoSlots]{};
+};
+
+inline Snapshot collect() {
+    constexpr auto relaxed{std::memory_order_relaxed};
+    Snapshot snap{};
+    snap.at = std::chrono::steady_clock::now();
+
+    auto& r{registry()};
+    std::lock_guard<std::mutex> lock{r.mtx};
+    for (const auto& s : r.shards) {
+        snap.rx_datagrams += s->rx_datagrams.load(relaxed);
+        snap.rx_bytes += s->rx_bytes.load(relaxed);
+        snap.tx_datagrams += s->tx_datagrams.load(relaxed);
+        snap.tx_bytes += s->tx_bytes.load(relaxed);
+        snap.batches += s->batches.load(relaxed);
+        snap.batched += s->batched.load(relaxed);
+        for (size_t i = 0; i < kBatchBuckets; i++) {
+            snap.batch_sizes[i] += s->batch_sizes[i].load(relaxed);
+        }
+        snap.kernel_drops += s->kernel_drops.load(relaxed);
+        for (size_t i = 0; i < kErrnoSlots; i++) {
+            snap.errors[i] += s->errors[i].load(relaxed);
+        }
+    }
+    if (r.queue != nullptr) {
+        snap.queue_dropped_newest = r.queue->dropped_newest.load(relaxed);
+        snap.queue_dropped_oldest = r.queue->dropped_oldest.load(relaxed);
+        snap.queue_blocked = r.queue->blocked.load(relaxed);
+    }
+    return snap;
+}
+
+inline uint64_t total_errors(const Snapshot& snap) noexcept {
+    uint64_t n{0};
+    for (const auto e : snap.errors) n += e;
+    return n;
+}
+
+namespace {
+
+inline std::string errno_name(size_t num) {
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 32)
+    if (const char* name{::strerrorname_np(static_cast<int>(num))}) {
+        return name;
+    }
+#endif
+#endif
+    return std::to_string(num);
+}
+
+}  // namespace
+
+// Prometheus text exposition format, version 0.0.4.
+inline std::string exposition(const Snapshot& snap) {
+    std::stringstream str{};
+    const auto counter = [&str](const char* name, const char* help,
+                                uint64_t value) {
+        str << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " counter\n"
+            << name << " " << value << "\n";
+    };
+
+    counter("mcast_received_datagrams_total", "Datagrams received.",
+            snap.rx_datagrams);
+    counter("mcast_received_bytes_total", "UDP payload bytes received.",
+            snap.rx_bytes);
+    counter("mcast_sent_datagrams_total", "Datagrams sent.",
+            snap.tx_datagrams);
+    counter("mcast_sent_bytes_total", "UDP payload bytes sent.",
+            snap.tx_bytes);
+    counter("mcast_kernel_drops_total",
+            "Datagrams dropped by the kernel for want of socket buffer space.",
+            snap.kernel_drops);
+
+    str << "# HELP mcast_queue_drops_total "
+           "Datagrams dropped by the output queue.\n"
+        << "# TYPE mcast_queue_drops_total counter\n"
+        << "mcast_queue_drops_total{policy=\"drop-newest\"} "
+        << snap.queue_dropped_newest << "\n"
+        << "mcast_queue_drops_total{policy=\"drop-oldest\"} "
+        << snap.queue_dropped_oldest << "\n";
+    counter("mcast_queue_blocked_total",
+            "Pushes that had to wait for room in the output queue.",
+            snap.queue_blocked);
+
+    str << "# HELP mcast_batch_size Datagrams per receive call.\n"
+        << "# TYPE mcast_batch_size histogram\n";
+    uint64_t cumulative{0};
+    for (size_t i = 0; i < kBatchBuckets; i++) {
+        cumulative += snap.batch_sizes[i];
+        str << "mcast_batch_size_bucket{le=\"";
+        if (i + 1 < kBatchBuckets) {
+            str << (uint64_t{1} << i);
+        } else {
+            str << "+Inf";
+        }
+        str << "\"} " << cumulative << "\n";
+    }
+    str << "mcast_batch_size_sum " << snap.batched << "\n"
+        << "mcast_batch_size_count " << snap.batches << "\n";
+
+    str << "# HELP mcast_errors_total Failed socket calls, by errno.\n"
+        << "# TYPE mcast_errors_total counter\n";
+    for (size_t i = 0; i < kErrnoSlots; i++) {
+        if (snap.errors[i] == 0) continue;
+        str << "mcast_errors_total{errno=\"" << errno_name(i) << "\"} "
+            << snap.errors[i] << "\n";
+    }
+    return str.str();
+}
+
+// Rates since prev, on one line.
+inline std::string summary(const Snapshot& prev, const Snapshot& cur) {
+    const double secs{std::max(1e-9, std::chrono::duration<double>(
+            cur.at - prev.at).count())};
+    const auto rate = [secs](uint64_t now, uint64_t before) {
+        return static_cast<uint64_t>(static_cast<double>(now - before) / secs);
+    };
+    const uint64_t batches{cur.batches - prev.batches};
+
+    std::stringstream str{};
+    str.precision(1);
+    str << std::fixed << "metrics: rx "
+        << rate(cur.rx_datagrams, prev.rx_datagrams) << " pps "
+        << (rate(cur.rx_bytes, prev.rx_bytes) / 1e6) << " MB/s, tx "
+        << rate(cur.tx_datagrams, prev.tx_datagrams) << " pps "
+        << (rate(cur.tx_bytes, prev.tx_bytes) / 1e6) << " MB/s";
+    if (batches > 0) {
+        str << ", batch avg " << (static_cast<double>(
+                cur.rx_datagrams - prev.rx_datagrams) / batches);
+    }
+    str << ", errors " << (total_errors(cur) - total_errors(prev))
+        << ", kernel drops " << (cur.kernel_drops - prev.kernel_drops)
+        << ", queue drops "
+        << ((cur.queue_dropped_newest + cur.queue_dropped_oldest) -
+            (prev.queue_dropped_newest + prev.queue_dropped_oldest));
+    return str.str();
+}
+
+// The most recent aggregate, as published for scrapes.
+struct Exporter {
+    std::mutex mtx{};
+    Snapshot latest{};
+};
+
+// Aggregate every interval; with print_summary, also describe each
+// interval on stderr.
+inline void aggregate(Exporter& exporter, std::chrono::milliseconds interval,
+                      bool print_summary, std::ostream& os) {
+    Snapshot prev{collect()};
+    {
+        std::lock_guard<std::mutex> lock{exporter.mtx};
+        exporter.latest = prev;
+    }
+    while (true) {
+        std::this_thread::sleep_for(interval);
+        const Snapshot cur{collect()};
+        {
+            std::lock_guard<std::mutex> lock{exporter.mtx};
+            exporter.latest = cur;
+        }
+        if (print_summary) {
+            os << summary(prev, cur) << std::endl;
+        }
+        prev = cur;
+    }
+}
+
+// "unix:/path/to/socket", "port" (on 127.0.0.1) or "host:port", where
+// host is a numeric loopback address.
+inline ErrorOr<socket::Socket> listen_on(const std::string& endpoint) {
+    if (endpoint.rfind("unix:", 0) == 0) {
+        struct sockaddr_un sun{};
+        sun.sun_family = AF_UNIX;
+        const std::string path{endpoint.substr(5)};
+        if (path.empty() || path.size() >= sizeof(sun.sun_path)) {
+            return error::Error{ENAMETOOLONG};
+        }
+        memcpy(sun.sun_path, path.c_str(), path.size());
+
+        socket::Socket s{::socket(AF_UNIX, SOCK_STREAM, 0)};
+        if (s.fd < 0) return error::current();
+        ::unlink(path.c_str());
+        if (::bind(s.fd, reinterpret_cast<const struct sockaddr*>(&sun),
+                   sizeof(sun)) != 0 ||
+            ::listen(s.fd, 16) != 0) {
+            return error::current();
+        }
+        s.at_exit.push_back([path]() { ::unlink(path.c_str()); });
+        return s;
+    }
+
+    const auto colon{endpoint.rfind(':')};
+    const std::string host{(colon == std::string::npos)
+            ? "127.0.0.1" : endpoint.substr(0, colon)};
+    const int port{std::atoi(endpoint.c_str() +
+                             ((colon == std::string::npos) ? 0 : colon + 1))};
+    if (port <= 0 || port > 0xffff) {
+        return error::Error{EINVAL};
+    }
+
+    struct sockaddr_storage ss{};
+    struct sockaddr_in sin{};
+    struct sockaddr_in6 sin6{};
+    if (::inet_pton(AF_INET, host.c_str(), &(sin.sin_addr)) == 1) {
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(static_cast<uint16_t>(port));
+        memcpy(&ss, &sin, sizeof(sin));
+    } else if (::inet_pton(AF_INET6, host.c_str(), &(sin6.sin6_addr)) == 1) {
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = htons(static_cast<uint16_t>(port));
+        memcpy(&ss, &sin6, sizeof(sin6));
+    } else {
+        return error::Error{EINVAL};
+    }
+    // The metrics say what this host receives, and from whom: keep them
+    // to this host.
+    const bool loopback{(ss.ss_family == AF_INET)
+            ? (ntohl(sin.sin_addr.s_addr) >> 24) == 127
+            : IN6_IS_ADDR_LOOPBACK(&(sin6.sin6_addr))};
+    if (not loopback) {
+        return error::Error{EADDRNOTAVAIL};
+    }
+
+    socket::Socket s{::socket(ss.ss_family, SOCK_STREAM, 0)};
+    if (s.fd < 0) return error::current();
+    for (const auto& e :
+            {
+                socket::enable(s, SOL_SOCKET, SO_REUSEADDR),
+                error::from(::bind(s.fd, socket::sockaddr_ptr(ss),
+                                   socket::socklen(ss))),
+                error::from(::listen(s.fd, 16)),
+            }) {
+        if (not error::ok(e)) {
+            return e;
+        }
+    }
+    return s;
+}
+
+// Answer every connection with the latest aggregate, as HTTP/1.0, so that
+// both Prometheus and curl (--unix-socket, for Unix sockets) can read it.
+// Requests are not parsed: any path gets the metrics.
+inline void serve(socket::Socket& listener, Exporter& exporter) {
+    while (true) {
+        const int fd{::accept(listener.fd, nullptr, nullptr)};
+        if (fd < 0) {
+            if (errno != EINTR) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        socket::Socket conn{fd};
+
+        // Read the request headers, but don't wait long for them.
+        char request[4096];
+        struct pollfd pfd{conn.fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 1000) > 0) {
+            (void)::recv(conn.fd, request, sizeof(request), 0);
+        }
+
+        Snapshot snap{};
+        {
+            std::lock_guard<std::mutex> lock{exporter.mtx};
+            snap = exporter.latest;
+        }
+        const std::string body{exposition(snap)};
+        const std::string response{
+                "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n"
+                "\r\n" + body};
+#ifdef MSG_NOSIGNAL  // not available on macOS
+        const int flags{MSG_NOSIGNAL};
+#else
+        const int flags{0};
+#endif
+        size_t off{0};
+        while (off < response.size()) {
+            const ssize_t n{::send(conn.fd, response.data() + off,
+                                   response.size() - off, flags)};
+            if (n <= 0) break;
+            off += static_cast<size_t>(n);
+        }
+    }
+}
+
+}  // namespace metrics
+}  // namespace mcast
+
+#endif  // MCAST_METRICS_H
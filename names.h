@@ -0,0 +1,282 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_NAMES_H
+#define MCAST_NAMES_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "socket.h"
+
+namespace mcast {
+namespace names {
+
+// Source addresses as socket::to_string() renders them, remembered in a
+// small direct-mapped cache per thread: the rendering of an address never
+// changes, and a busy group has few enough senders to mostly hit.
+struct AddressCache {
+    static constexpr size_t kSlots{256};
+
+    struct Slot {
+        uint8_t addr[16]{};
+        uint32_t scope{0};
+        uint16_t port{0};
+        uint16_t family{0};  // 0: empty
+        uint8_t len{0};
+        char text[87]{};  // "[" v6 "%" ifname "]:" port
+    };
+
+    Slot slots[kSlots]{};
+};
+
+namespace {
+
+inline AddressCache& address_cache() {
+    thread_local AddressCache cache{};
+    return cache;
+}
+
+// Fill in the key fields of slot from ss; false if not IPv4 or IPv6.
+inline bool address_key(const struct sockaddr_storage& ss,
+                        AddressCache::Slot& key) noexcept {
+    key.family = ss.ss_family;
+    if (const auto* sin{socket::sockaddr_in_ptr(ss)}) {
+        memcpy(key.addr, &(sin->sin_addr), 4);
+        key.port = sin->sin_port;
+        return true;
+    }
+    if (const auto* sin6{socket::sockaddr_in6_ptr(ss)}) {
+        memcpy(key.addr, &(sin6->sin6_addr), 16);
+        key.port = sin6->sin6_port;
+        key.scope = sin6->sin6_scope_id;
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+inline void append_address(std::string& out,
+                           const struct sockaddr_storage& ss) {
+    AddressCache::Slot key{};
+    if (not address_key(ss, key)) {
+        out.append(socket::to_string(ss));
+        return;
+    }
+
+    uint64_t h{0xcbf29ce484222325};  // FNV-1a
+    const auto mix = [&h](const uint8_t* p, size_t n) {
+        for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 0x100000001b3;
+    };
+    mix(key.addr, sizeof(key.addr));
+    mix(reinterpret_cast<const uint8_t*>(&key.port), sizeof(key.port));
+    mix(reinterpret_cast<const uint8_t*>(&key.scope), sizeof(key.scope));
+    auto& slot{address_cache().slots[h % AddressCache::kSlots]};
+
+    if (slot.family != key.family || slot.port != key.port ||
+        slot.scope != key.scope ||
+        memcmp(slot.addr, key.addr, sizeof(key.addr)) != 0) {
+        const std::string text{socket::to_string(ss)};
+        if (text.size() > sizeof(slot.text)) {
+            out.append(text);
+            return;
+        }
+        slot = key;
+        slot.len = static_cast<uint8_t>(text.size());
+        memcpy(slot.text, text.data(), text.size());
+    }
+    out.append(slot.text, slot.len);
+}
+
+// Interface names by index. Readers copy a name out under a sequence
+// lock, without writing to shared memory; on Linux a thread listening to
+// rtnetlink link events keeps the table current, so a rename or a new
+// interface shows up without polling. Indices beyond the table, and
+// other platforms, fall back to if_indextoname().
+constexpr unsigned kMaxIfindex{4096};
+
+struct Interfaces {
+    std::atomic<uint32_t> seq{0};
+    // IFNAMSIZ bytes of NUL-padded name per index; all zero if unknown.
+    std::atomic<uint64_t> names[kMaxIfindex][2]{};
+    std::mutex writer{};
+};
+static_assert(IFNAMSIZ <= 2 * sizeof(uint64_t));
+
+namespace {
+
+inline void store_name(Interfaces& t, unsigned ifindex, const char* name,
+                       bool only_if_unknown = false) {
+    if (ifindex >= kMaxIfindex) return;
+    uint64_t words[2]{};
+    if (name != nullptr) {
+        memcpy(words, name, std::min(strlen(name), sizeof(words) - 1));
+    }
+
+    std::lock_guard<std::mutex> lock{t.writer};
+    if (only_if_unknown &&
+        t.names[ifindex][0].load(std::memory_order_relaxed) != 0) {
+        return;  // rtnetlink got there first, and knows better
+    }
+    const uint32_t s{t.seq.load(std::memory_order_relaxed)};
+    t.seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    t.names[ifindex][0].store(words[0], std::memory_order_relaxed);
+    t.names[ifindex][1].store(words[1], std::memory_order_relaxed);
+    t.seq.store(s + 2, std::memory_order_release);
+}
+
+// Copies the name into buf (IFNAMSIZ bytes) and returns its length; 0
+// if unknown.
+inline size_t load_name(const Interfaces& t, unsigned ifindex,
+                        char* buf) noexcept {
+    uint64_t words[2]{};
+    uint32_t before{0};
+    uint32_t after{0};
+    do {
+        before = t.seq.load(std::memory_order_acquire);
+        words[0] = t.names[ifindex][0].load(std::memory_order_relaxed);
+        words[1] = t.names[ifindex][1].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = t.seq.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    memcpy(buf, words, IFNAMSIZ);
+    buf[IFNAMSIZ - 1] = '\0';
+    return strlen(buf);
+}
+
+#ifdef __linux__
+inline bool request_links(int fd) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req{};
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.ifi.ifi_family = AF_UNSPEC;
+    return ::send(fd, &req, req.nh.nlmsg_len, 0) ==
+           static_cast<ssize_t>(req.nh.nlmsg_len);
+}
+
+inline void apply(Interfaces& t, const struct nlmsghdr* nh) {
+    if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) {
+        return;
+    }
+    const auto* ifi{static_cast<const struct ifinfomsg*>(NLMSG_DATA(nh))};
+    if (ifi->ifi_index <= 0) return;
+    const unsigned ifindex{static_cast<unsigned>(ifi->ifi_index)};
+
+    if (nh->nlmsg_type == RTM_DELLINK) {
+        store_name(t, ifindex, nullptr);
+        return;
+    }
+    int len{static_cast<int>(IFLA_PAYLOAD(nh))};
+    for (auto* rta{IFLA_RTA(ifi)}; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            char name[IFNAMSIZ]{};
+            memcpy(name, RTA_DATA(rta),
+                   std::min(static_cast<size_t>(RTA_PAYLOAD(rta)),
+                            sizeof(name) - 1));
+            store_name(t, ifindex, name);
+        }
+    }
+}
+
+// Dump all links, then follow changes. Should events be lost (the
+// socket overran), dump again.
+inline void follow_links(Interfaces& t) {
+    const int fd{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)};
+    if (fd < 0) return;
+    socket::Socket s{fd};
+
+    struct sockaddr_nl snl{};
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK;
+    if (::bind(s.fd, reinterpret_cast<const struct sockaddr*>(&snl),
+               sizeof(snl)) != 0 ||
+        not request_links(s.fd)) {
+        return;
+    }
+
+    alignas(struct nlmsghdr) char buf[32768];
+    while (true) {
+        ssize_t n{::recv(s.fd, buf, sizeof(buf), 0)};
+        if (n < 0) {
+            if (errno == ENOBUFS) {
+                request_links(s.fd);
+            } else if (errno != EINTR) {
+                return;
+            }
+            continue;
+        }
+        int len{static_cast<int>(n)};
+        for (auto* nh{reinterpret_cast<struct nlmsghdr*>(buf)};
+             NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            apply(t, nh);
+        }
+    }
+}
+#endif
+
+}  // namespace
+
+inline Interfaces& interfaces() {
+    static Interfaces table{};
+#ifdef __linux__
+    static std::once_flag started{};
+    std::call_once(started, []() {
+        std::thread{follow_links, std::ref(table)}.detach();
+    });
+#endif
+    return table;
+}
+
+inline void append_interface(std::string& out, unsigned ifindex) {
+    if (ifindex >= kMaxIfindex) {
+        out.append(socket::if_index2name(ifindex));
+        return;
+    }
+    auto& t{interfaces()};
+    char name[IFNAMSIZ];
+    size_t len{load_name(t, ifindex, name)};
+    if (len == 0) {
+        // Not (yet) heard of; ask, and remember until told otherwise.
+        const std::string fetched{socket::if_index2name(ifindex)};
+        store_name(t, ifindex, fetched.c_str(), true);
+        out.append(fetched);
+        return;
+    }
+    out.append(name, len);
+}
+
+}  // namespace names
+}  // namespace mcast
+
+#endif  // MCAST_NAMES_H
@@ -0,0 +1,145 @@
+#!/usr/bin/env bash
+# LICENSE_BEGIN
+#
+#     Apache 2.0 License
+#
+#     SPDX:Apache-2.0
+#
+#     https://spdx.org/licenses/Apache-2.0
+#
+#     See LICENSE file in the top level directory.
+#
+# LICENSE_END
+
+# End-to-end throughput of mcast over a veth pair between two network
+# namespaces: no real network needed, and both ends go through the usual
+# socket setup, group join included. Needs root.
+#
+#     sudo ./netns-bench.sh
+#     sudo SIZES="64 1472" RATES="100k 0" DURATION=5 ./netns-bench.sh
+#     sudo LISTEN_ARGS="-b 64 -R" SEND_ARGS="-b 64 -S" ./netns-bench.sh
+#
+# For each size and rate (pps; k/M suffixes; 0 for flat out) this prints
+# what was sent and received, the loss seen by the receiver's probe
+# analyzer, UDP receive buffer overflows, and user+system CPU time per
+# datagram on each side.
+
+set -euo pipefail
+
+MCAST=${MCAST:-./mcast}
+GROUP=${GROUP:-239.255.42.42}
+PORT=${PORT:-4242}
+SIZES=${SIZES:-64 512 1472}
+RATES=${RATES:-10k 100k 0}
+DURATION=${DURATION:-3}
+LISTEN_ARGS=${LISTEN_ARGS:-}
+SEND_ARGS=${SEND_ARGS:-}
+
+if [[ $(id -u) -ne 0 ]]; then
+    echo "$0: must be run as root" >&2
+    exit 1
+fi
+if [[ ! -x $MCAST ]]; then
+    echo "$0: $MCAST not found; run make first" >&2
+    exit 1
+fi
+MCAST=$(realpath "$MCAST")
+
+TX=mcast-tx-$$
+RX=mcast-rx-$$
+WORK=$(mktemp -d)
+
+cleanup() {
+    ip netns pids "$RX" 2>/dev/null | xargs -r kill 2>/dev/null || true
+    ip netns pids "$TX" 2>/dev/null | xargs -r kill 2>/dev/null || true
+    ip netns del "$TX" 2>/dev/null || true
+    ip netns del "$RX" 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+ip netns add "$TX"
+ip netns add "$RX"
+ip link add veth-tx netns "$TX" type veth peer name veth-rx netns "$RX"
+ip -n "$TX" addr add 10.42.0.1/24 dev veth-tx
+ip -n "$RX" addr add 10.42.0.2/24 dev veth-rx
+for ns in "$TX" "$RX"; do
+    ip -n "$ns" link set lo up
+done
+ip -n "$TX" link set veth-tx up
+ip -n "$RX" link set veth-rx up
+ip -n "$TX" route add 224.0.0.0/4 dev veth-tx
+ip -n "$RX" route add 224.0.0.0/4 dev veth-rx
+
+# Sum of the children's user and system time, in ms, from the output of
+# the bash builtin `times`.
+cpu_ms() {
+    tail -n 1 "$1" | awk '{
+        t = 0
+        for (i = 1; i <= 2; i++) {
+            split($i, a, /[ms]/)
+            t += a[1] * 60000 + a[2] * 1000
+        }
+        printf "%d", t
+    }'
+}
+
+rcvbuf_errors() {
+    ip netns exec "$RX" awk '/^Udp:/ && $2 ~ /^[0-9]/ { print $6 }' \
+        /proc/net/snmp
+}
+
+printf "%6s %8s %10s %10s %10s %8s %8s %10s %10s\n" \
+       size rate sent rcvd rcvd/s lost% rcvbuf tx_ns/dg rx_ns/dg
+
+for size in $SIZES; do
+    for rate in $RATES; do
+        errors_before=$(rcvbuf_errors)
+
+        # shellcheck disable=SC2086
+        (
+            ip netns exec "$RX" "$MCAST" -g "$GROUP" -p "$PORT" -a \
+                $LISTEN_ARGS >"$WORK/rx.out" 2>&1 &
+            echo $! >"$WORK/rx.pid"
+            wait $! || true
+            times >"$WORK/rx.times"
+        ) &
+        rx_shell=$!
+        sleep 0.5
+
+        # shellcheck disable=SC2086
+        (
+            ip netns exec "$TX" "$MCAST" -g "$GROUP" -p "$PORT" \
+                -n "$rate" -s "$size" -D "$DURATION" \
+                $SEND_ARGS >"$WORK/tx.out" 2>&1 || true
+            times >"$WORK/tx.times"
+        )
+
+        # Let the receiver drain before asking for its final report.
+        sleep 0.5
+        kill -INT "$(cat "$WORK/rx.pid")" 2>/dev/null || true
+        wait "$rx_shell" || true
+
+        sent=$(sed -n 's/^sent [0-9]* bytes in \([0-9]*\) datagrams.*/\1/p' \
+                   "$WORK/tx.out" | tail -n 1)
+        report=$(grep ' rcvd (' "$WORK/rx.out" | tail -n 1 || true)
+        rcvd=$(sed -n 's/.*: \([0-9]*\) rcvd (.*/\1/p' <<<"$report")
+        lost=$(sed -n 's/.* lost (\([0-9.e+-]*\)%).*/\1/p' <<<"$report")
+        sent=${sent:-0}
+        rcvd=${rcvd:-0}
+        lost=${lost:-100}
+
+        tx_ms=$(cpu_ms "$WORK/tx.times")
+        rx_ms=$(cpu_ms "$WORK/rx.times")
+        errors=$(( $(rcvbuf_errors) - errors_before ))
+
+        awk -v size="$size" -v rate="$rate" -v sent="$sent" -v rcvd="$rcvd" \
+            -v lost="$lost" -v errors="$errors" -v secs="$DURATION" \
+            -v tx_ms="$tx_ms" -v rx_ms="$rx_ms" 'BEGIN {
+                printf "%6d %8s %10d %10d %10d %8.2f %8d %10d %10d\n",
+                       size, rate, sent, rcvd, rcvd / secs, lost, errors,
+                       (sent > 0) ? tx_ms * 1e6 / sent : 0,
+                       (rcvd > 0) ? rx_ms * 1e6 / rcvd : 0
+            }'
+    done
+done
@@ -0,0 +1,65 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_PACE_H
+#define MCAST_PACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <cerrno>
+
+#include "ring.h"
+
+namespace mcast {
+namespace pace {
+
+inline uint64_t now_ns(clockid_t clock = CLOCK_MONOTONIC) noexcept {
+    struct timespec ts{};
+    ::clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 +
+           static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Below this, sleeping overshoots by more than it saves.
+constexpr uint64_t kSpinNs{100'000};
+
+// Wait until CLOCK_MONOTONIC reaches deadline_ns: sleep through most of
+// the wait, then spin for the last stretch. Returns how late we are.
+inline uint64_t until(uint64_t deadline_ns) noexcept {
+    uint64_t now{now_ns()};
+    if (deadline_ns > now + kSpinNs) {
+        const uint64_t wake{deadline_ns - kSpinNs};
+        struct timespec ts{static_cast<time_t>(wake / 1'000'000'000),
+                           static_cast<long>(wake % 1'000'000'000)};
+#ifdef TIMER_ABSTIME
+        while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)
+               == EINTR) {}
+#else
+        const uint64_t rel{wake - now};
+        ts = {static_cast<time_t>(rel / 1'000'000'000),
+              static_cast<long>(rel % 1'000'000'000)};
+        ::nanosleep(&ts, nullptr);
+#endif
+        now = now_ns();
+    }
+    while (now < deadline_ns) {
+        ring::cpu_relax();
+        now = now_ns();
+    }
+    return now - deadline_ns;
+}
+
+}  // namespace pace
+}  // namespace mcast
+
+#endif  // MCAST_PACE_H
@@ -0,0 +1,346 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_PACKET_H
+#define MCAST_PACKET_H
+
+#if defined(__linux__) && __has_include(<linux/if_packet.h>)
+#include <linux/if_packet.h>
+#endif
+
+// TPACKET_V3 block rings; without them there is no capture mode.
+#ifdef TPACKET3_HDRLEN
+#define MCAST_HAVE_PACKET 1
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "bpf.h"
+#include "error.h"
+#include "socket.h"
+
+namespace mcast {
+namespace packet {
+
+// One UDP datagram found in a captured frame. `data` points into the ring
+// and is only valid until the callback that received it returns.
+struct Datagram {
+    struct sockaddr_storage from{};
+    socket::AuxiliaryData aux{};
+    const uint8_t* data{nullptr};
+    size_t len{0};
+};
+
+// AF_PACKET socket with a mmap()d TPACKET_V3 receive ring.
+struct Ring {
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    ~Ring() {
+        if (map != nullptr) ::munmap(map, map_len);
+    }
+
+    struct tpacket_block_desc* block(unsigned i) const noexcept {
+        return reinterpret_cast<struct tpacket_block_desc*>(
+                static_cast<uint8_t*>(map) +
+                static_cast<size_t>(i) * req.tp_block_size);
+    }
+
+    socket::Socket s{};
+    void* map{nullptr};
+    size_t map_len{0};
+    struct tpacket_req3 req{};
+    unsigned next_block{0};
+    struct sockaddr_storage group{};
+};
+
+// Accept only UDP to the group and port; everything else stays in the
+// kernel. Offsets are relative to the network header (SOCK_DGRAM).
+inline bpf::Program group_filter(const struct sockaddr_storage& group) {
+    using bpf::jump;
+    using bpf::stmt;
+
+    if (const auto* sin = socket::sockaddr_in_ptr(group)) {
+        return {
+            stmt(BPF_LD | BPF_B | BPF_ABS, 9),                  // protocol
+            jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 8),
+            stmt(BPF_LD | BPF_W | BPF_ABS, 16),                 // daddr
+            jump(BPF_JMP | BPF_JEQ | BPF_K,
+                 ntohl(sin->sin_addr.s_addr), 0, 6),
+            stmt(BPF_LD | BPF_H | BPF_ABS, 6),                  // frag offset
+            jump(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),
+            stmt(BPF_LDX | BPF_B | BPF_MSH, 0),                 // X = IHL
+            stmt(BPF_LD | BPF_H | BPF_IND, 2),                  // dport
+            jump(BPF_JMP | BPF_JEQ | BPF_K, ntohs(sin->sin_port), 0, 1),
+            stmt(BPF_RET | BPF_K, bpf::kAccept),
+            stmt(BPF_RET | BPF_K, bpf::kDrop),
+        };
+    }
+
+    const auto* sin6{socket::sockaddr_in6_ptr(group)};
+    uint32_t words[4]{};
+    memcpy(words, &(sin6->sin6_addr), sizeof(words));
+    // Extension headers are not followed here; parse() copes with them
+    // should a future filter let them through.
+    return {
+        stmt(BPF_LD | BPF_B | BPF_ABS, 6),                      // next header
+        jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 11),
+        stmt(BPF_LD | BPF_W | BPF_ABS, 24),                     // daddr
+        jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(words[0]), 0, 9),
+        stmt(BPF_LD | BPF_W | BPF_ABS, 28),
+        jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(words[1]), 0, 7),
+        stmt(BPF_LD | BPF_W | BPF_ABS, 32),
+        jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(words[2]), 0, 5),
+        stmt(BPF_LD | BPF_W | BPF_ABS, 36),
+        jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(words[3]), 0, 3),
+        stmt(BPF_LD | BPF_H | BPF_ABS, 42),                     // dport
+        jump(BPF_JMP | BPF_JEQ | BPF_K, ntohs(sin6->sin6_port), 0, 1),
+        stmt(BPF_RET | BPF_K, bpf::kAccept),
+        stmt(BPF_RET | BPF_K, bpf::kDrop),
+    };
+}
+
+// Open a capture ring for the group (address and port). With fanout_id
+// >= 0 the socket joins that PACKET_FANOUT group, so that several rings
+// (typically one per thread) split the traffic by flow hash.
+inline ErrorOr<std::unique_ptr<Ring>>
+open(const struct sockaddr_storage& group, int fanout_id = -1) {
+    auto r{std::make_unique<Ring>()};
+    r->group = group;
+
+    const uint16_t proto{htons((group.ss_family == AF_INET) ? ETH_P_IP
+                                                             : ETH_P_IPV6)};
+    if (group.ss_family != AF_INET && group.ss_family != AF_INET6) {
+        return error::Error{EAFNOSUPPORT};
+    }
+
+    // Created unbound (protocol 0), so nothing is queued before the filter
+    // and the ring are in place.
+    const int fd{::socket(AF_PACKET, SOCK_DGRAM, 0)};
+    if (fd < 0) {
+        return error::current();
+    }
+    r->s = socket::Socket{fd};
+
+    auto e{bpf::attach(r->s, group_filter(group))};
+    if (not error::ok(e)) return e;
+    e = socket::set(r->s, SOL_PACKET, PACKET_VERSION, TPACKET_V3);
+    if (not error::ok(e)) return e;
+
+    auto& req{r->req};
+    req.tp_block_size = 1 << 20;
+    req.tp_block_nr = 16;
+    req.tp_frame_size = 1 << 11;
+    req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) *
+                      req.tp_block_nr;
+    req.tp_retire_blk_tov = 10;  // ms before a partly filled block is handed over
+    req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    e = socket::set(r->s, SOL_PACKET, PACKET_RX_RING, req);
+    if (not error::ok(e)) return e;
+
+    r->map_len = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+    void* ptr = ::mmap(nullptr, r->map_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_LOCKED, r->s.fd, 0);
+    if (ptr == MAP_FAILED) {
+        // MAP_LOCKED may exceed RLIMIT_MEMLOCK; the ring works without it.
+        ptr = ::mmap(nullptr, r->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, r->s.fd, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        return error::current();
+    }
+    r->map = ptr;
+
+    struct sockaddr_ll sll{};
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = proto;
+    sll.sll_ifindex = 0;  // all interfaces
+    error::clear();
+    if (::bind(r->s.fd, reinterpret_cast<struct sockaddr*>(&sll),
+               sizeof(sll)) < 0) {
+        return error::current();
+    }
+
+    if (fanout_id >= 0) {
+        const int fanout{(fanout_id & 0xffff) |
+                         ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG)
+                          << 16)};
+        e = socket::set(r->s, SOL_PACKET, PACKET_FANOUT, fanout);
+        if (not error::ok(e)) return e;
+    }
+
+    return r;
+}
+
+// Pull the UDP datagram out of an IPv4/IPv6 packet, filling in the same
+// ancillary data a UDP socket would have reported.
+inline bool parse(const uint8_t* pkt, size_t len, unsigned ifindex,
+                  Datagram& out) {
+    if (len < 1) return false;
+
+    size_t udp_off{0};
+    switch (pkt[0] >> 4) {
+        case 4: {
+            if (len < 20) return false;
+            const size_t ihl{static_cast<size_t>(pkt[0] & 0x0f) * 4};
+            if (ihl < 20 || len < ihl + 8 || pkt[9] != IPPROTO_UDP) {
+                return false;
+            }
+            const uint16_t frag{static_cast<uint16_t>((pkt[6] << 8) | pkt[7])};
+            if ((frag & 0x1fff) != 0) return false;  // not the first fragment
+
+            auto* sin{reinterpret_cast<struct sockaddr_in*>(&(out.from))};
+            sin->sin_family = AF_INET;
+            memcpy(&(sin->sin_addr), pkt + 12, 4);
+            memcpy(&(sin->sin_port), pkt + ihl, 2);
+
+            struct in_pktinfo pi{};
+            pi.ipi_ifindex = static_cast<int>(ifindex);
+            memcpy(&(pi.ipi_addr), pkt + 16, 4);
+            out.aux.pktinfo = pi;
+            out.aux.hoplimit = pkt[8];
+            out.aux.dscp = pkt[1];
+            udp_off = ihl;
+            break;
+        }
+
+        case 6: {
+            if (len < 40 + 8) return false;
+            uint8_t next{pkt[6]};
+            size_t off{40};
+            // Skip the common extension headers.
+            while (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING ||
+                   next == IPPROTO_DSTOPTS || next == IPPROTO_FRAGMENT) {
+                if (len < off + 8) return false;
+                if (next == IPPROTO_FRAGMENT) {
+                    const uint16_t frag{static_cast<uint16_t>(
+                            (pkt[off + 2] << 8) | pkt[off + 3])};
+                    if ((frag & 0xfff8) != 0) return false;
+                    next = pkt[off];
+                    off += 8;
+                } else {
+                    const size_t ext_len{(static_cast<size_t>(pkt[off + 1]) + 1)
+                                         * 8};
+                    next = pkt[off];
+                    off += ext_len;
+                }
+            }
+            if (next != IPPROTO_UDP || len < off + 8) return false;
+
+            auto* sin6{reinterpret_cast<struct sockaddr_in6*>(&(out.from))};
+            sin6->sin6_family = AF_INET6;
+            memcpy(&(sin6->sin6_addr), pkt + 8, 16);
+            memcpy(&(sin6->sin6_port), pkt + off, 2);
+            if (IN6_IS_ADDR_LINKLOCAL(&(sin6->sin6_addr))) {
+                sin6->sin6_scope_id = ifindex;
+            }
+
+            struct in6_pktinfo pi{};
+            pi.ipi6_ifindex = ifindex;
+            memcpy(&(pi.ipi6_addr), pkt + 24, 16);
+            out.aux.pktinfo = pi;
+            out.aux.hoplimit = pkt[7];
+            out.aux.dscp = ((pkt[0] & 0x0f) << 4) | (pkt[1] >> 4);
+            udp_off = off;
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    const size_t udp_len{static_cast<size_t>(
+            (pkt[udp_off + 4] << 8) | pkt[udp_off + 5])};
+    out.data = pkt + udp_off + 8;
+    out.len = std::min(len - udp_off - 8,
+                       (udp_len >= 8) ? udp_len - 8 : static_cast<size_t>(0));
+    return true;
+}
+
+// Wait up to timeout_ms for the next block, then hand every datagram in
+// every ready block to fn(const Datagram&) and return the blocks to the
+// kernel. Returns the number of datagrams delivered.
+template<typename Fn>
+inline ErrorOr<size_t> capture(Ring& r, int timeout_ms, Fn&& fn) {
+    auto* bd{r.block(r.next_block)};
+    if (not (__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE)
+             & TP_STATUS_USER)) {
+        struct pollfd pfd{r.s.fd, POLLIN | POLLERR, 0};
+        error::clear();
+        if (::poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+            return error::current();
+        }
+    }
+
+    size_t delivered{0};
+    while (__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE)
+           & TP_STATUS_USER) {
+        const auto* hdr{reinterpret_cast<const struct tpacket3_hdr*>(
+                reinterpret_cast<const uint8_t*>(bd) +
+                bd->hdr.bh1.offset_to_first_pkt)};
+        for (uint32_t i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            const auto* base{reinterpret_cast<const uint8_t*>(hdr)};
+            const auto* sll{reinterpret_cast<const struct sockaddr_ll*>(
+                    base + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)))};
+
+            // Frames on their way out are not traffic seen on the wire;
+            // on lo they would show every datagram twice.
+            if (sll->sll_pkttype == PACKET_OUTGOING) {
+                hdr = reinterpret_cast<const struct tpacket3_hdr*>(
+                        base + hdr->tp_next_offset);
+                continue;
+            }
+
+            Datagram d{};
+            d.aux.rx_time = timespec{static_cast<time_t>(hdr->tp_sec),
+                                     static_cast<long>(hdr->tp_nsec)};
+            if (parse(base + hdr->tp_net, hdr->tp_snaplen,
+                      static_cast<unsigned>(sll->sll_ifindex), d)) {
+                fn(static_cast<const Datagram&>(d));
+                delivered++;
+            }
+            hdr = reinterpret_cast<const struct tpacket3_hdr*>(
+                    base + hdr->tp_next_offset);
+        }
+
+        __atomic_store_n(&(bd->hdr.bh1.block_status), TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        r.next_block = (r.next_block + 1) % r.req.tp_block_nr;
+        bd = r.block(r.next_block);
+    }
+    return delivered;
+}
+
+// Packets seen and dropped by the kernel since the last call.
+inline ErrorOr<struct tpacket_stats_v3> stats(Ring& r) {
+    struct tpacket_stats_v3 st{};
+    socklen_t len{sizeof(st)};
+    error::clear();
+    if (::getsockopt(r.s.fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+        return error::current();
+    }
+    return st;
+}
+
+}  // namespace packet
+}  // namespace mcast
+
+#endif  // TPACKET3_HDRLEN
+
+#endif  // MCAST_PACKET_H
@@ -0,0 +1,645 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_PCAPNG_H
+#define MCAST_PCAPNG_H
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "error.h"
+#include "socket.h"
+
+namespace mcast {
+namespace pcapng {
+
+// Start a new file once the current one reaches max_bytes or has been
+// open for max_age; zero disables either limit.
+struct Rotation {
+    uint64_t max_bytes{0};
+    std::chrono::seconds max_age{0};
+};
+
+// Writes received datagrams as pcapng (LINKTYPE_RAW, nanosecond
+// timestamps), synthesizing the IP and UDP headers the socket stripped.
+// Blocks are collected in memory and written out in large chunks.
+struct Writer {
+    Writer() = default;
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer();
+
+    std::string path{};
+    struct sockaddr_storage group{};
+    Rotation rotation{};
+
+    int fd{-1};
+    unsigned index{0};         // of the current file
+    uint64_t file_bytes{0};    // written to, or pending for, the current file
+    std::chrono::steady_clock::time_point opened{};
+    std::chrono::steady_clock::time_point last_flush{};
+    std::vector<uint8_t> buf{};
+    std::mutex mtx{};
+};
+
+constexpr size_t kFlushBytes{1 << 20};
+constexpr auto kFlushInterval{std::chrono::seconds(1)};
+
+namespace {
+
+constexpr uint32_t kSectionHeaderBlock{0x0a0d0d0a};
+constexpr uint32_t kInterfaceDescriptionBlock{0x00000001};
+constexpr uint32_t kEnhancedPacketBlock{0x00000006};
+constexpr uint32_t kByteOrderMagic{0x1a2b3c4d};
+constexpr uint16_t kLinktypeRaw{101};  // IPv4 or IPv6, no link layer
+constexpr uint16_t kOptEndOfOpt{0};
+constexpr uint16_t kOptShbUserAppl{4};
+constexpr uint16_t kOptIfTsResol{9};
+
+template<typename Int>
+void put(std::vector<uint8_t>& buf, Int value) {
+    const auto* p{reinterpret_cast<const uint8_t*>(&value)};
+    buf.insert(buf.end(), p, p + sizeof(value));
+}
+
+void put_bytes(std::vector<uint8_t>& buf, const void* data, size_t len) {
+    const auto* p{static_cast<const uint8_t*>(data)};
+    buf.insert(buf.end(), p, p + len);
+    buf.resize(buf.size() + ((4 - (len % 4)) % 4), 0);
+}
+
+void put_option(std::vector<uint8_t>& buf, uint16_t code,
+                const void* data, uint16_t len) {
+    put(buf, code);
+    put(buf, len);
+    put_bytes(buf, data, len);
+}
+
+// Blocks begin and end with their total length; patch both in once the
+// body is known.
+size_t begin_block(std::vector<uint8_t>& buf, uint32_t type) {
+    const size_t start{buf.size()};
+    put(buf, type);
+    put(buf, uint32_t{0});
+    return start;
+}
+
+void end_block(std::vector<uint8_t>& buf, size_t start) {
+    const uint32_t len{static_cast<uint32_t>(buf.size() - start + 4)};
+    memcpy(buf.data() + start + 4, &len, sizeof(len));
+    put(buf, len);
+}
+
+uint16_t fold(uint32_t sum) noexcept {
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return static_cast<uint16_t>(~sum);
+}
+
+uint32_t sum16(const uint8_t* data, size_t len, uint32_t sum = 0) noexcept {
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (len % 2) sum += data[len - 1] << 8;
+    return sum;
+}
+
+// The IP and UDP headers the datagram would have arrived with. Returns
+// the header length, or 0 for an unsupported address family.
+size_t make_headers(uint8_t* hdr, const struct sockaddr_storage& from,
+                    const struct sockaddr_storage& group,
+                    const socket::AuxiliaryData& aux,
+                    const uint8_t* data, size_t len) {
+    const int hops{socket::has_hoplimit(aux) ? socket::get_hoplimit(aux) : 0};
+    const int tos{socket::has_dscp(aux) ? socket::get_dscp(aux) : 0};
+    const uint16_t udp_len{static_cast<uint16_t>(8 + len)};
+
+    switch (from.ss_family) {
+        case AF_INET: {
+            const auto* src{socket::sockaddr_in_ptr(from)};
+            const auto* dst{socket::sockaddr_in_ptr(group)};
+            const uint16_t total{static_cast<uint16_t>(20 + udp_len)};
+            memset(hdr, 0, 28);
+            hdr[0] = 0x45;
+            hdr[1] = static_cast<uint8_t>(tos);
+            hdr[2] = total >> 8;
+            hdr[3] = total & 0xff;
+            hdr[8] = static_cast<uint8_t>(hops);
+            hdr[9] = IPPROTO_UDP;
+            memcpy(hdr + 12, &(src->sin_addr), 4);
+            memcpy(hdr + 16, &(dst->sin_addr), 4);
+            const uint16_t csum{fold(sum16(hdr, 20))};
+            hdr[10] = csum >> 8;
+            hdr[11] = csum & 0xff;
+
+            memcpy(hdr + 20, &(src->sin_port), 2);
+            memcpy(hdr + 22, &(dst->sin_port), 2);
+            hdr[24] = udp_len >> 8;
+            hdr[25] = udp_len & 0xff;
+            // A zero UDP checksum means "none" over IPv4.
+            return 28;
+        }
+
+        case AF_INET6: {
+            const auto* src{socket::sockaddr_in6_ptr(from)};
+            const auto* dst{socket::sockaddr_in6_ptr(group)};
+            memset(hdr, 0, 48);
+            hdr[0] = 0x60 | ((tos >> 4) & 0x0f);
+            hdr[1] = (tos & 0x0f) << 4;
+            hdr[4] = udp_len >> 8;
+            hdr[5] = udp_len & 0xff;
+            hdr[6] = IPPROTO_UDP;
+            hdr[7] = static_cast<uint8_t>(hops);
+            memcpy(hdr + 8, &(src->sin6_addr), 16);
+            memcpy(hdr + 24, &(dst->sin6_addr), 16);
+
+            memcpy(hdr + 40, &(src->sin6_port), 2);
+            memcpy(hdr + 42, &(dst->sin6_port), 2);
+            hdr[44] = udp_len >> 8;
+            hdr[45] = udp_len & 0xff;
+            // Mandatory over IPv6: pseudo-header, UDP header, payload.
+            uint32_t sum{sum16(hdr + 8, 32)};
+            sum += udp_len + IPPROTO_UDP;
+            sum = sum16(hdr + 40, 8, sum);
+            sum = sum16(data, len, sum);
+            uint16_t csum{fold(sum)};
+            if (csum == 0) csum = 0xffff;
+            hdr[46] = csum >> 8;
+            hdr[47] = csum & 0xff;
+            return 48;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+void put_file_header(Writer& w) {
+    auto shb{begin_block(w.buf, kSectionHeaderBlock)};
+    put(w.buf, kByteOrderMagic);
+    put(w.buf, uint16_t{1});   // major
+    put(w.buf, uint16_t{0});   // minor
+    put(w.buf, int64_t{-1});   // section length: unknown
+    const char appl[]{"mcast"};
+    put_option(w.buf, kOptShbUserAppl, appl, sizeof(appl) - 1);
+    put(w.buf, kOptEndOfOpt);
+    put(w.buf, uint16_t{0});
+    end_block(w.buf, shb);
+
+    auto idb{begin_block(w.buf, kInterfaceDescriptionBlock)};
+    put(w.buf, kLinktypeRaw);
+    put(w.buf, uint16_t{0});   // reserved
+    put(w.buf, uint32_t{0});   // snaplen: unlimited
+    const uint8_t nanoseconds{9};
+    put_option(w.buf, kOptIfTsResol, &nanoseconds, sizeof(nanoseconds));
+    put(w.buf, kOptEndOfOpt);
+    put(w.buf, uint16_t{0});
+    end_block(w.buf, idb);
+}
+
+std::string file_name(const Writer& w) {
+    // tcpdump-style: the first file keeps the given name.
+    return (w.index == 0) ? w.path : w.path + "." + std::to_string(w.index);
+}
+
+}  // namespace
+
+inline error::Error flush(Writer& w) {
+    size_t off{0};
+    while (off < w.buf.size()) {
+        const ssize_t rval{::write(w.fd, w.buf.data() + off,
+                                   w.buf.size() - off)};
+        if (rval < 0) {
+            if (errno == EINTR) continue;
+            const auto e{error::current()};
+            w.buf.erase(w.buf.begin(), w.buf.begin() + off);
+            return e;
+        }
+        off += static_cast<size_t>(rval);
+    }
+    w.buf.clear();
+    w.last_flush = std::chrono::steady_clock::now();
+    return error::success();
+}
+
+// Finish the current file, if any, and start the next one. The next one
+// gets a new name even if finishing failed: reopening the same name would
+// truncate what it holds.
+inline error::Error rotate(Writer& w) {
+    if (w.fd >= 0) {
+        const auto e{flush(w)};
+        ::close(w.fd);
+        w.fd = -1;
+        w.index++;
+        if (not error::ok(e)) return e;
+    }
+
+    const int fd{::open(file_name(w).c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if (fd < 0) {
+        return error::current();
+    }
+    w.fd = fd;
+    w.opened = std::chrono::steady_clock::now();
+    w.buf.clear();
+    put_file_header(w);
+    w.file_bytes = w.buf.size();
+    return error::success();
+}
+
+inline Writer::~Writer() {
+    if (fd >= 0) {
+        flush(*this);
+        ::close(fd);
+    }
+}
+
+inline ErrorOr<std::unique_ptr<Writer>>
+open(const std::string& path, const struct sockaddr_storage& group,
+     const Rotation& rotation) {
+    if (group.ss_family != AF_INET && group.ss_family != AF_INET6) {
+        return error::Error{EAFNOSUPPORT};
+    }
+
+    auto w{std::make_unique<Writer>()};
+    w->path = path;
+    w->group = group;
+    w->rotation = rotation;
+    w->buf.reserve(kFlushBytes + (1 << 16));
+
+    const auto e{rotate(*w)};
+    if (not error::ok(e)) return e;
+    return w;
+}
+
+// Append one datagram. Safe to call from several threads.
+inline error::Error write(Writer& w,
+                          const struct sockaddr_storage& from,
+                          const socket::AuxiliaryData& aux,
+                          const uint8_t* data, size_t len) {
+    std::lock_guard<std::mutex> lock{w.mtx};
+
+    uint8_t hdr[48];
+    const size_t hdr_len{make_headers(hdr, from, w.group, aux, data, len)};
+    if (hdr_len == 0) {
+        return error::Error{EAFNOSUPPORT};
+    }
+    const uint32_t captured{static_cast<uint32_t>(hdr_len + len)};
+    const size_t block_len{28 + ((captured + 3) & ~size_t{3}) + 4};
+
+    const auto now{std::chrono::steady_clock::now()};
+    const bool too_big{w.rotation.max_bytes > 0 &&
+                       w.file_bytes + block_len > w.rotation.max_bytes};
+    const bool too_old{w.rotation.max_age.count() > 0 &&
+                       now - w.opened >= w.rotation.max_age};
+    if (too_big || too_old) {
+        const auto e{rotate(w)};
+        if (not error::ok(e)) return e;
+    }
+
+    struct timespec ts{};
+    if (socket::has_rx_time(aux)) {
+        ts = socket::get_rx_time(aux);
+    } else {
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+    }
+    const uint64_t ns{static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 +
+                      static_cast<uint64_t>(ts.tv_nsec)};
+
+    auto epb{begin_block(w.buf, kEnhancedPacketBlock)};
+    put(w.buf, uint32_t{0});  // interface
+    put(w.buf, static_cast<uint32_t>(ns >> 32));
+    put(w.buf, static_cast<uint32_t>(ns & 0xffffffff));
+    put(w.buf, captured);
+    put(w.buf, captured);  // original length
+    w.buf.insert(w.buf.end(), hdr, hdr + hdr_len);  // a multiple of 4
+    put_bytes(w.buf, data, len);
+    end_block(w.buf, epb);
+    w.file_bytes += block_len;
+
+    if (w.buf.size() >= kFlushBytes || now - w.last_flush >= kFlushInterval) {
+        return flush(w);
+    }
+    return error::success();
+}
+
+// Write out anything buffered, e.g. while no traffic is arriving.
+inline error::Error sync(Writer& w) {
+    std::lock_guard<std::mutex> lock{w.mtx};
+    if (w.buf.empty()) return error::success();
+    return flush(w);
+}
+
+// Reading captures back, for replay: pcapng as written above, and also
+// classic pcap, from any of the common link types.
+
+// One captured frame, pointing into the mapped file.
+struct Frame {
+    uint64_t ts_ns{0};
+    uint16_t linktype{0};
+    const uint8_t* data{nullptr};
+    size_t len{0};
+};
+
+struct Reader {
+    struct Interface {
+        uint16_t linktype{0};
+        uint8_t tsresol{6};  // pcapng if_tsresol encoding
+    };
+
+    Reader() = default;
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    ~Reader() {
+        if (map != nullptr) ::munmap(const_cast<uint8_t*>(map), map_len);
+    }
+
+    const uint8_t* map{nullptr};
+    size_t map_len{0};
+    size_t off{0};
+    bool ng{false};
+    bool swapped{false};      // file is in the other byte order
+    uint8_t tsresol{6};       // classic pcap: micro- (6) or nanoseconds (9)
+    std::vector<Interface> interfaces{};  // classic pcap: exactly one
+};
+
+namespace {
+
+constexpr uint32_t kPcapMagicUs{0xa1b2c3d4};
+constexpr uint32_t kPcapMagicNs{0xa1b23c4d};
+constexpr uint32_t kSimplePacketBlock{0x00000003};
+constexpr uint32_t kObsoletePacketBlock{0x00000002};
+
+uint16_t get16(const Reader& r, size_t off) noexcept {
+    uint16_t v{0};
+    memcpy(&v, r.map + off, sizeof(v));
+    return r.swapped ? __builtin_bswap16(v) : v;
+}
+
+uint32_t get32(const Reader& r, size_t off) noexcept {
+    uint32_t v{0};
+    memcpy(&v, r.map + off, sizeof(v));
+    return r.swapped ? __builtin_bswap32(v) : v;
+}
+
+uint64_t to_ns(uint64_t units, uint8_t tsresol) noexcept {
+    if (tsresol & 0x80) {
+        return static_cast<uint64_t>(
+                (static_cast<unsigned __int128>(units) * 1'000'000'000) >>
+                (tsresol & 0x7f));
+    }
+    uint64_t scale{1};
+    for (int i = tsresol; i < 9; i++) scale *= 10;
+    for (int i = 9; i < tsresol; i++) units /= 10;
+    return units * scale;
+}
+
+// Read the options of an interface description block.
+Reader::Interface read_interface(const Reader& r, size_t body, size_t end) {
+    Reader::Interface intf{};
+    intf.linktype = get16(r, body);
+    for (size_t opt = body + 8; opt + 4 <= end;) {
+        const uint16_t code{get16(r, opt)};
+        const uint16_t len{get16(r, opt + 2)};
+        if (code == kOptEndOfOpt || opt + 4 + len > end) break;
+        if (code == kOptIfTsResol && len >= 1) intf.tsresol = r.map[opt + 4];
+        opt += 4 + ((len + 3) & ~3u);
+    }
+    return intf;
+}
+
+bool next_ng(Reader& r, Frame& f) {
+    while (r.off + 12 <= r.map_len) {
+        const size_t start{r.off};
+        uint32_t type{0};
+        memcpy(&type, r.map + start, sizeof(type));  // same in both orders
+        if (type == kSectionHeaderBlock) {
+            uint32_t bom{0};
+            memcpy(&bom, r.map + start + 8, sizeof(bom));
+            r.swapped = (bom != kByteOrderMagic);
+            r.interfaces.clear();
+        }
+        const uint32_t len{get32(r, start + 4)};
+        if (len < 12 || len % 4 != 0 || start + len > r.map_len) {
+            return false;  // truncated or corrupt
+        }
+        r.off += len;
+
+        const size_t body{start + 8};
+        const size_t end{start + len - 4};
+        switch (type) {
+            case kInterfaceDescriptionBlock:
+                if (end >= body + 8) {
+                    r.interfaces.push_back(read_interface(r, body, end));
+                }
+                break;
+
+            case kEnhancedPacketBlock: {
+                if (end < body + 20) break;
+                const uint32_t intf{get32(r, body)};
+                const uint32_t caplen{get32(r, body + 12)};
+                if (intf >= r.interfaces.size() || body + 20 + caplen > end) {
+                    break;
+                }
+                const uint64_t units{(static_cast<uint64_t>(get32(r, body + 4))
+                                      << 32) | get32(r, body + 8)};
+                f.ts_ns = to_ns(units, r.interfaces[intf].tsresol);
+                f.linktype = r.interfaces[intf].linktype;
+                f.data = r.map + body + 20;
+                f.len = caplen;
+                return true;
+            }
+
+            case kSimplePacketBlock:
+            case kObsoletePacketBlock:
+                // No usable timestamp to pace by.
+                break;
+
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+bool next_classic(Reader& r, Frame& f) {
+    if (r.off + 16 > r.map_len) return false;
+    const uint32_t sec{get32(r, r.off)};
+    const uint32_t frac{get32(r, r.off + 4)};
+    const uint32_t caplen{get32(r, r.off + 8)};
+    if (r.off + 16 + caplen > r.map_len) return false;
+
+    f.ts_ns = static_cast<uint64_t>(sec) * 1'000'000'000 +
+              to_ns(frac, r.tsresol);
+    f.linktype = r.interfaces[0].linktype;
+    f.data = r.map + r.off + 16;
+    f.len = caplen;
+    r.off += 16 + caplen;
+    return true;
+}
+
+}  // namespace
+
+inline ErrorOr<std::unique_ptr<Reader>> open_reader(const std::string& path) {
+    const int fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd < 0) {
+        return error::current();
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) < 0) {
+        const auto e{error::current()};
+        ::close(fd);
+        return e;
+    }
+
+    auto r{std::make_unique<Reader>()};
+    r->map_len = static_cast<size_t>(st.st_size);
+    if (r->map_len < 24) {
+        ::close(fd);
+        return error::Error{EINVAL};
+    }
+    void* map{::mmap(nullptr, r->map_len, PROT_READ, MAP_PRIVATE, fd, 0)};
+    const auto e{error::current()};
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return e;
+    }
+    r->map = static_cast<const uint8_t*>(map);
+    ::madvise(map, r->map_len, MADV_SEQUENTIAL);
+
+    uint32_t magic{0};
+    memcpy(&magic, r->map, sizeof(magic));
+    if (magic == kSectionHeaderBlock) {
+        r->ng = true;
+        return r;
+    }
+    for (const bool swapped : {false, true}) {
+        const uint32_t m{swapped ? __builtin_bswap32(magic) : magic};
+        if (m == kPcapMagicUs || m == kPcapMagicNs) {
+            r->swapped = swapped;
+            r->tsresol = (m == kPcapMagicNs) ? 9 : 6;
+            r->interfaces.push_back(
+                    {static_cast<uint16_t>(get32(*r, 20) & 0xffff), 6});
+            r->off = 24;
+            return r;
+        }
+    }
+    return error::Error{EINVAL};
+}
+
+// The next captured frame, or false at the end of the file.
+inline bool next(Reader& r, Frame& f) {
+    return r.ng ? next_ng(r, f) : next_classic(r, f);
+}
+
+// Find the UDP payload inside a captured frame, looking through the link
+// layer and IPv4/IPv6 headers. Non-UDP frames and trailing fragments are
+// skipped (false).
+inline bool udp_payload(const Frame& f, const uint8_t*& data, size_t& len) {
+    const uint8_t* p{f.data};
+    size_t n{f.len};
+    uint16_t ethertype{0};
+
+    switch (f.linktype) {
+        case 0:    // BSD loopback: host-order address family
+            if (n < 4) return false;
+            p += 4;
+            n -= 4;
+            break;
+        case 1:    // Ethernet, possibly with one 802.1Q tag
+            if (n < 14) return false;
+            ethertype = static_cast<uint16_t>((p[12] << 8) | p[13]);
+            p += 14;
+            n -= 14;
+            if (ethertype == 0x8100 && n >= 4) {
+                p += 4;
+                n -= 4;
+            }
+            break;
+        case 113:  // Linux cooked capture
+            if (n < 16) return false;
+            p += 16;
+            n -= 16;
+            break;
+        case 276:  // Linux cooked capture v2
+            if (n < 20) return false;
+            p += 20;
+            n -= 20;
+            break;
+        case kLinktypeRaw:
+        case 228:  // IPv4
+        case 229:  // IPv6
+            break;
+        default:
+            return false;
+    }
+    if (n < 1) return false;
+
+    size_t udp_off{0};
+    switch (p[0] >> 4) {
+        case 4: {
+            const size_t ihl{static_cast<size_t>(p[0] & 0x0f) * 4};
+            if (ihl < 20 || n < ihl + 8 || p[9] != IPPROTO_UDP) return false;
+            if ((((p[6] << 8) | p[7]) & 0x1fff) != 0) return false;
+            udp_off = ihl;
+            break;
+        }
+        case 6: {
+            if (n < 48) return false;
+            uint8_t next_hdr{p[6]};
+            size_t off{40};
+            while (next_hdr == IPPROTO_HOPOPTS || next_hdr == IPPROTO_ROUTING ||
+                   next_hdr == IPPROTO_DSTOPTS || next_hdr == IPPROTO_FRAGMENT) {
+                if (n < off + 8) return false;
+                if (next_hdr == IPPROTO_FRAGMENT &&
+                    (((p[off + 2] << 8) | p[off + 3]) & 0xfff8) != 0) {
+                    return false;
+                }
+                const size_t ext{(next_hdr == IPPROTO_FRAGMENT)
+                                 ? 8 : (static_cast<size_t>(p[off + 1]) + 1) * 8};
+                next_hdr = p[off];
+                off += ext;
+            }
+            if (next_hdr != IPPROTO_UDP || n < off + 8) return false;
+            udp_off = off;
+            break;
+        }
+        default:
+            return false;
+    }
+
+    const size_t udp_len{static_cast<size_t>((p[udp_off + 4] << 8) |
+                                             p[udp_off + 5])};
+    data = p + udp_off + 8;
+    len = std::min(n - udp_off - 8,
+                   (udp_len >= 8) ? udp_len - 8 : static_cast<size_t>(0));
+    return true;
+}
+
+}  // namespace pcapng
+}  // namespace mcast
+
+#endif  // MCAST_PCAPNG_H
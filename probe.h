@@ -0,0 +1,308 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_PROBE_H
+#define MCAST_PROBE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "histogram.h"
+#include "socket.h"
+
+namespace mcast {
+namespace probe {
+
+// Generated test traffic starts with this header (all fields big-endian);
+// whatever follows is padding.
+//
+//     0       4       8              16              24
+//     | magic | stream|      seq     |     tx_ns     | padding...
+//
+// stream tells apart runs (and senders sharing an address); tx_ns is the
+// sender's CLOCK_REALTIME when the datagram was handed to the kernel.
+constexpr uint32_t kMagic{0x6d637374};  // "mcst"
+constexpr size_t kHeaderSize{24};
+
+struct Header {
+    uint32_t stream{0};
+    uint64_t seq{0};
+    uint64_t tx_ns{0};
+};
+
+namespace {
+
+inline void put_be(uint8_t* p, uint64_t v, size_t n) noexcept {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = static_cast<uint8_t>(v >> (8 * (n - 1 - i)));
+    }
+}
+
+inline uint64_t get_be(const uint8_t* p, size_t n) noexcept {
+    uint64_t v{0};
+    for (size_t i = 0; i < n; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+}  // namespace
+
+inline void encode(uint8_t* buf, const Header& h) noexcept {
+    put_be(buf, kMagic, 4);
+    put_be(buf + 4, h.stream, 4);
+    put_be(buf + 8, h.seq, 8);
+    put_be(buf + 16, h.tx_ns, 8);
+}
+
+inline bool decode(const uint8_t* data, size_t len, Header& h) noexcept {
+    if (len < kHeaderSize || get_be(data, 4) != kMagic) return false;
+    h.stream = static_cast<uint32_t>(get_be(data + 4, 4));
+    h.seq = get_be(data + 8, 8);
+    h.tx_ns = get_be(data + 16, 8);
+    return true;
+}
+
+// Receive-side state for one (source, stream).
+struct Flow {
+    // Which of the last kWindow sequence numbers (up to max_seq) arrived,
+    // indexed by seq % kWindow; older ones can no longer be told apart
+    // from duplicates.
+    static constexpr uint64_t kWindow{1024};
+
+    uint64_t received{0};
+    uint64_t duplicates{0};
+    uint64_t reordered{0};
+    uint64_t max_reorder{0};  // deepest: how far behind max_seq
+    uint64_t first_seq{0};
+    uint64_t max_seq{0};
+    uint64_t seen[kWindow / 64]{};
+
+    // RFC 3550 interarrival jitter, in ns.
+    int64_t last_transit{0};
+    double jitter{0};
+
+    // One-way latency (receive timestamp minus the sender's), in ns. Only
+    // meaningful with synchronized clocks; arrivals apparently from the
+    // future are counted rather than recorded.
+    histogram::Histogram latency{};
+    uint64_t negative_latency{0};
+
+    uint64_t reported{0};  // received, as of the previous report
+};
+
+struct FlowKey {
+    uint8_t addr[16]{};
+    uint16_t port{0};
+    uint16_t family{0};
+    uint32_t stream{0};
+
+    bool operator==(const FlowKey& other) const noexcept {
+        return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+};
+static_assert(sizeof(FlowKey) == 24);
+
+struct FlowKeyHash {
+    size_t operator()(const FlowKey& k) const noexcept {
+        // FNV-1a
+        uint64_t h{0xcbf29ce484222325};
+        const auto* p{reinterpret_cast<const uint8_t*>(&k)};
+        for (size_t i = 0; i < sizeof(k); i++) {
+            h = (h ^ p[i]) * 0x100000001b3;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
+// Per-source loss, duplication, reordering, jitter and latency of generated
+// traffic. Safe to feed from several threads.
+struct Analyzer {
+    std::unordered_map<FlowKey, Flow, FlowKeyHash> flows{};
+    uint64_t foreign{0};  // datagrams without a probe header
+    std::chrono::steady_clock::time_point last_report{
+            std::chrono::steady_clock::now()};
+    std::mutex mtx{};
+};
+
+namespace {
+
+inline FlowKey key_for(const struct sockaddr_storage& from, uint32_t stream) {
+    FlowKey k{};
+    k.family = from.ss_family;
+    k.stream = stream;
+    switch (from.ss_family) {
+        case AF_INET: {
+            const auto* sin{socket::sockaddr_in_ptr(from)};
+            memcpy(k.addr, &(sin->sin_addr), 4);
+            k.port = sin->sin_port;
+            break;
+        }
+        case AF_INET6: {
+            const auto* sin6{socket::sockaddr_in6_ptr(from)};
+            memcpy(k.addr, &(sin6->sin6_addr), 16);
+            k.port = sin6->sin6_port;
+            break;
+        }
+    }
+    return k;
+}
+
+inline bool test_and_set(Flow& f, uint64_t seq) noexcept {
+    uint64_t& word{f.seen[(seq % Flow::kWindow) / 64]};
+    const uint64_t bit{uint64_t{1} << (seq % 64)};
+    const bool was_set{(word & bit) != 0};
+    word |= bit;
+    return was_set;
+}
+
+inline void clear(Flow& f, uint64_t seq) noexcept {
+    f.seen[(seq % Flow::kWindow) / 64] &= ~(uint64_t{1} << (seq % 64));
+}
+
+inline void update(Flow& f, const Header& h, uint64_t rx_ns) {
+    if (f.received == 0) {
+        f.first_seq = h.seq;
+        f.max_seq = h.seq;
+        test_and_set(f, h.seq);
+    } else if (h.seq > f.max_seq) {
+        // Forget what falls out of the window.
+        if (h.seq - f.max_seq >= Flow::kWindow) {
+            memset(f.seen, 0, sizeof(f.seen));
+        } else {
+            for (uint64_t s = f.max_seq + 1; s < h.seq; s++) clear(f, s);
+        }
+        f.max_seq = h.seq;
+        test_and_set(f, h.seq);
+    } else {
+        const uint64_t behind{f.max_seq - h.seq};
+        if (behind < Flow::kWindow && test_and_set(f, h.seq)) {
+            f.duplicates++;
+            return;
+        }
+        f.reordered++;
+        f.max_reorder = std::max(f.max_reorder, behind);
+        f.first_seq = std::min(f.first_seq, h.seq);
+    }
+
+    // Clock offsets between sender and receiver cancel out.
+    const int64_t transit{static_cast<int64_t>(rx_ns - h.tx_ns)};
+    if (f.received > 0) {
+        const double d{static_cast<double>(std::llabs(transit - f.last_transit))};
+        f.jitter += (d - f.jitter) / 16;
+    }
+    f.last_transit = transit;
+    if (rx_ns >= h.tx_ns) {
+        histogram::record(f.latency, rx_ns - h.tx_ns);
+    } else {
+        f.negative_latency++;
+    }
+    f.received++;
+}
+
+}  // namespace
+
+inline void record(Analyzer& a,
+                   const struct sockaddr_storage& from,
+                   const socket::AuxiliaryData& aux,
+                   const uint8_t* data, size_t len) {
+    uint64_t rx_ns{0};
+    if (socket::has_rx_time(aux)) {
+        const auto ts{socket::get_rx_time(aux)};
+        rx_ns = static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 +
+                static_cast<uint64_t>(ts.tv_nsec);
+    } else {
+        struct timespec ts{};
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        rx_ns = static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 +
+                static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    Header h{};
+    const bool ours{decode(data, len, h)};
+
+    std::lock_guard<std::mutex> lock{a.mtx};
+    if (not ours) {
+        a.foreign++;
+        return;
+    }
+    update(a.flows[key_for(from, h.stream)], h, rx_ns);
+}
+
+inline uint64_t lost(const Flow& f) noexcept {
+    const uint64_t expected{f.max_seq - f.first_seq + 1};
+    const uint64_t unique{f.received};  // duplicates are not counted in
+    return (expected > unique) ? expected - unique : 0;
+}
+
+// One line per flow: totals since the start, plus the receive rate since
+// the previous report.
+inline std::string report(Analyzer& a) {
+    std::lock_guard<std::mutex> lock{a.mtx};
+    const auto now{std::chrono::steady_clock::now()};
+    const double secs{std::chrono::duration<double>(
+            now - a.last_report).count()};
+    a.last_report = now;
+
+    std::stringstream str{};
+    for (auto& [key, f] : a.flows) {
+        struct sockaddr_storage ss{};
+        ss.ss_family = key.family;
+        if (key.family == AF_INET) {
+            auto* sin{socket::sockaddr_in_ptr(ss)};
+            memcpy(&(sin->sin_addr), key.addr, 4);
+            sin->sin_port = key.port;
+        } else {
+            auto* sin6{socket::sockaddr_in6_ptr(ss)};
+            memcpy(&(sin6->sin6_addr), key.addr, 16);
+            sin6->sin6_port = key.port;
+        }
+
+        const uint64_t l{lost(f)};
+        const uint64_t expected{f.max_seq - f.first_seq + 1};
+        str << socket::to_string(ss) << " stream " << std::hex << key.stream
+            << std::dec << ": " << f.received << " rcvd ("
+            << static_cast<uint64_t>((f.received - f.reported) /
+                                     (secs > 0 ? secs : 1))
+            << "/s), " << l << " lost ("
+            << (100.0 * static_cast<double>(l) / static_cast<double>(expected))
+            << "%), " << f.duplicates << " dup, " << f.reordered
+            << " reordered (max depth " << f.max_reorder << "), jitter "
+            << (f.jitter / 1000) << " us";
+        if (f.latency.total > 0) {
+            str << "\n  latency: " << histogram::summary_us(f.latency);
+        }
+        if (f.negative_latency > 0) {
+            str << "\n  " << f.negative_latency
+                << " arrived before they were sent: are clocks in sync?";
+        }
+        str << "\n";
+        f.reported = f.received;
+    }
+    if (a.foreign > 0) {
+        str << a.foreign << " datagrams without a probe header\n";
+    }
+    return str.str();
+}
+
+}  // namespace probe
+}  // namespace mcast
+
+#endif  // MCAST_PROBE_H
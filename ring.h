@@ -0,0 +1,207 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_RING_H
+#define MCAST_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace mcast {
+namespace ring {
+
+// What push() does when the ring is full.
+enum class Overflow {
+    BLOCK,        // wait for a consumer to make room
+    DROP_NEWEST,  // discard the item being pushed
+    DROP_OLDEST,  // discard the oldest queued item to make room
+};
+
+struct Counters {
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> popped{0};
+    std::atomic<uint64_t> dropped_newest{0};
+    std::atomic<uint64_t> dropped_oldest{0};
+    std::atomic<uint64_t> blocked{0};  // pushes that had to wait
+};
+
+// A bounded, lock-free multi-producer/multi-consumer queue of T, after
+// Dmitry Vyukov's design: every slot carries a sequence number saying
+// whether it is free for the producer at position p (seq == p) or holds
+// the item for the consumer at position p (seq == p + 1). Items are
+// written and copied out in place; nothing is allocated after creation.
+template<typename T>
+struct Ring {
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        T value{};
+    };
+
+    Ring(size_t depth, Overflow policy) : overflow(policy) {
+        size_t capacity{2};
+        while (capacity < depth) capacity <<= 1;
+        mask = capacity - 1;
+        slots = std::make_unique<Slot[]>(capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    size_t capacity() const noexcept { return mask + 1; }
+
+    std::unique_ptr<Slot[]> slots{};
+    size_t mask{0};
+    Overflow overflow{Overflow::BLOCK};
+
+    alignas(64) std::atomic<size_t> head{0};  // next position to pop
+    alignas(64) std::atomic<size_t> tail{0};  // next position to push
+    alignas(64) Counters counters{};
+};
+
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Spin briefly, then yield, then sleep: cheap when the wait is short,
+// without burning a core when it is not.
+struct Backoff {
+    void pause() {
+        if (spins < 64) {
+            cpu_relax();
+        } else if (spins < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        spins++;
+    }
+    void reset() noexcept { spins = 0; }
+
+    unsigned spins{0};
+};
+
+namespace {
+
+inline intptr_t distance(size_t seq, size_t pos) noexcept {
+    return static_cast<intptr_t>(seq - pos);
+}
+
+// Claim the oldest item, hand it to fn(T&) (if any), and release its slot.
+template<typename T, typename Fn>
+bool take(Ring<T>& r, Fn&& fn) {
+    size_t pos{r.head.load(std::memory_order_relaxed)};
+    while (true) {
+        auto& slot{r.slots[pos & r.mask]};
+        const size_t seq{slot.seq.load(std::memory_order_acquire)};
+        const intptr_t diff{distance(seq, pos + 1)};
+        if (diff == 0) {
+            if (r.head.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                fn(slot.value);
+                slot.seq.store(pos + r.mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;  // empty
+        } else {
+            pos = r.head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+}  // namespace
+
+// Queue one item, written in place by fill(T&). Returns false if the item
+// was dropped under Overflow::DROP_NEWEST. The only waiting done outside
+// Overflow::BLOCK is for a consumer that is mid-copy of the very slot we
+// need, i.e. for one memcpy of a T.
+template<typename T, typename Fill>
+bool push(Ring<T>& r, Fill&& fill) {
+    Backoff backoff{};
+    bool counted_block{false};
+    size_t pos{r.tail.load(std::memory_order_relaxed)};
+    while (true) {
+        auto& slot{r.slots[pos & r.mask]};
+        const size_t seq{slot.seq.load(std::memory_order_acquire)};
+        const intptr_t diff{distance(seq, pos)};
+        if (diff == 0) {
+            if (r.tail.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                fill(slot.value);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                r.counters.pushed.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            continue;
+        }
+        if (diff > 0) {
+            // Another producer took this position.
+            pos = r.tail.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        // Full, or the slot's previous item is still being copied out.
+        switch (r.overflow) {
+            case Overflow::DROP_NEWEST:
+                r.counters.dropped_newest.fetch_add(
+                        1, std::memory_order_relaxed);
+                return false;
+
+            case Overflow::DROP_OLDEST: {
+                const size_t head{r.head.load(std::memory_order_relaxed)};
+                if (pos - head >= r.capacity() &&
+                    take(r, [](T&) {})) {
+                    r.counters.dropped_oldest.fetch_add(
+                            1, std::memory_order_relaxed);
+                } else {
+                    cpu_relax();
+                }
+                break;
+            }
+
+            case Overflow::BLOCK:
+                if (not counted_block) {
+                    r.counters.blocked.fetch_add(1, std::memory_order_relaxed);
+                    counted_block = true;
+                }
+                backoff.pause();
+                break;
+        }
+        pos = r.tail.load(std::memory_order_relaxed);
+    }
+}
+
+// Copy the oldest item into out. Returns false if the ring is empty.
+template<typename T>
+bool pop(Ring<T>& r, T& out) {
+    if (not take(r, [&out](T& value) { out = value; })) {
+        return false;
+    }
+    r.counters.popped.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+}  // namespace ring
+}  // namespace mcast
+
+#endif  // MCAST_RING_H
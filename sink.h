@@ -0,0 +1,41 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_SINK_H
+#define MCAST_SINK_H
+
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace mcast {
+
+// Where formatted records go. Several receive threads may share one Sink;
+// each record is written whole, so output from different threads never
+// interleaves mid-record.
+struct Sink {
+    explicit Sink(std::ostream& out) : os(out) {}
+    Sink(const Sink&) = delete;
+    Sink& operator=(const Sink&) = delete;
+
+    std::ostream& os;
+    std::mutex mtx{};
+};
+
+inline void write(Sink& sink, const std::string& record) {
+    std::lock_guard<std::mutex> lock{sink.mtx};
+    sink.os << record << "\n";
+}
+
+}  // namespace mcast
+
+#endif  // MCAST_SINK_H
@@ -18,12 +18,22 @@ LICENSE_END */
 #include <netdb.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
 
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <optional>
 #include <sstream>
@@ -147,9 +157,11 @@ inline error::Error set_port(struct sockaddr_storage& ss, in_port_t port) {
 }
 
 
+// Empty if there is no such interface.
 inline std::string if_index2name(unsigned ifindex) {
     char buf[IFNAMSIZ+1]{};
-    return if_indextoname(ifindex, buf);
+    const char* name{if_indextoname(ifindex, buf)};
+    return (name != nullptr) ? name : "";
 }
 
 
@@ -264,15 +276,22 @@ inline ErrorOr<mcast::socket::Socket> makeForFamily(int addr_family) {
 }
 
 
-struct Msg {
+template<size_t Size>
+struct BasicMsg {
     struct sockaddr_storage ss{};
-    uint8_t cmsg[128]{};
-    uint8_t pckt[2048 - sizeof(ss) - sizeof(cmsg)]{};
+    uint8_t cmsg[256]{};
+    uint8_t pckt[Size - sizeof(ss) - sizeof(cmsg)]{};
 };
 
-static_assert(sizeof(struct Msg) == 2048);
+using Msg = BasicMsg<2048>;
+static_assert(sizeof(Msg) == 2048);
 
-inline void clear(Msg& m) noexcept {
+// Large enough for a full 64 KB UDP payload, e.g. a GSO super-datagram.
+using JumboMsg = BasicMsg<(1 << 16) + sizeof(Msg) - sizeof(Msg::pckt)>;
+static_assert(sizeof(JumboMsg::pckt) == (1 << 16));
+
+template<size_t Size>
+inline void clear(BasicMsg<Size>& m) noexcept {
     memset(&(m.ss), 0, sizeof(m.ss));
     m.ss.ss_family = AF_UNSPEC;
     memset(m.cmsg, 0, sizeof(m.cmsg));
@@ -284,7 +303,8 @@ struct MsgIO {
     struct msghdr mhdr{};
     struct iovec iov[1];
 
-    static MsgIO from(Msg& m) {
+    template<size_t Size>
+    static MsgIO from(BasicMsg<Size>& m) {
         MsgIO mio{};
 
         mio.iov[0].iov_base     = m.pckt;
@@ -301,7 +321,8 @@ struct MsgIO {
         return mio;
     }
 
-    static MsgIO from(const Msg& m) {
+    template<size_t Size>
+    static MsgIO from(const BasicMsg<Size>& m) {
         MsgIO mio{};
 
         mio.iov[0].iov_base     = (void*)(m.pckt);
@@ -320,36 +341,63 @@ struct MsgIO {
 };
 
 
-inline ErrorOr<ssize_t> recvmsg(Socket& s, Msg& m) {
+template<size_t Size>
+inline ErrorOr<ssize_t> recvmsg(Socket& s, BasicMsg<Size>& m, int flags = 0) {
     clear(m);
     auto mio{MsgIO::from(m)};
 
     error::clear();
-    const ssize_t rval = ::recvmsg(s.fd, &(mio.mhdr), 0);
+    const ssize_t rval = ::recvmsg(s.fd, &(mio.mhdr), flags);
     if (rval < 0) {
         return error::current();
     }
     return rval;
 }
 
-inline ErrorOr<ssize_t> sendmsg(Socket& s, Msg& m, size_t len) {
-    auto mio{MsgIO::from(m)};
+// Length of the run of well-formed cmsgs at the start of a control
+// buffer. The kernel rejects any trailing zeroed header, so this is what
+// must be passed as msg_controllen.
+inline size_t cmsg_length(const uint8_t* buf, size_t buflen) noexcept {
+    size_t used{0};
+    while (used + sizeof(struct cmsghdr) <= buflen) {
+        struct cmsghdr cmsg{};
+        memcpy(&cmsg, buf + used, sizeof(cmsg));
+        if (cmsg.cmsg_len < sizeof(struct cmsghdr)) break;
+        used += CMSG_SPACE(cmsg.cmsg_len - CMSG_LEN(0));
+    }
+    return std::min(used, buflen);
+}
+
+// Trim the headers describing m down to what sendmsg(2) should see.
+template<size_t Size>
+inline void
+prepare_for_send(MsgIO& mio, const BasicMsg<Size>& m, size_t len) noexcept {
+    mio.mhdr.msg_name       = (void*)&(m.ss);
+    mio.mhdr.msg_namelen    = sizeof(m.ss);
     if (m.ss.ss_family == AF_UNSPEC) {
         // No destination address; hopefully the socket is connect()d.
         mio.mhdr.msg_name = nullptr;
         mio.mhdr.msg_namelen = 0;
     }
-    mio.iov[0].iov_len = std::min(len, mio.iov[0].iov_len);
+    mio.iov[0].iov_len = std::min(len, sizeof(m.pckt));
 
-    auto* cmsg{reinterpret_cast<struct cmsghdr*>(mio.mhdr.msg_control)};
-    if (cmsg->cmsg_len == 0) {
+    mio.mhdr.msg_control    = (void*)m.cmsg;
+    mio.mhdr.msg_controllen = cmsg_length(m.cmsg, sizeof(m.cmsg));
+    if (mio.mhdr.msg_controllen == 0) {
         // Apparently no options in the cmsg area.
         mio.mhdr.msg_control    = nullptr;
-        mio.mhdr.msg_controllen = 0;
     }
+    mio.mhdr.msg_flags      = 0;
+}
+
+template<size_t Size>
+inline ErrorOr<ssize_t> sendmsg(Socket& s, BasicMsg<Size>& m, size_t len,
+                                int flags = 0) {
+    auto mio{MsgIO::from(m)};
+    prepare_for_send(mio, m, len);
 
     error::clear();
-    const ssize_t rval = ::sendmsg(s.fd, &(mio.mhdr), 0);
+    const ssize_t rval = ::sendmsg(s.fd, &(mio.mhdr), flags);
     if (rval < 0) {
         return error::current();
     }
@@ -357,9 +405,393 @@ inline ErrorOr<ssize_t> sendmsg(Socket& s, Msg& m, size_t len) {
 }
 
 
+#ifdef UDP_SEGMENT
+// Ask the kernel to split the payload of the next sendmsg() into
+// datagrams of gso_size bytes (UDP GSO). Replaces any other cmsgs.
+template<size_t Size>
+inline void set_segment_size(BasicMsg<Size>& m, uint16_t gso_size) noexcept {
+    static_assert(sizeof(m.cmsg) >= CMSG_SPACE(sizeof(gso_size)));
+    memset(m.cmsg, 0, sizeof(m.cmsg));
+
+    struct msghdr mhdr{};
+    mhdr.msg_control    = m.cmsg;
+    mhdr.msg_controllen = sizeof(m.cmsg);
+
+    struct cmsghdr* cmsg{CMSG_FIRSTHDR(&mhdr)};
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type  = UDP_SEGMENT;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(gso_size));
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+}
+#endif
+
+#ifdef SO_TXTIME  // not available on macOS
+// Have the qdisc (e.g. etf) launch datagrams sent with set_txtime() at
+// their stated time on `clock`, reporting misses on the error queue.
+inline error::Error enable_txtime(Socket& s, clockid_t clock) {
+    const struct sock_txtime config{clock, SOF_TXTIME_REPORT_ERRORS};
+    return set(s, SOL_SOCKET, SO_TXTIME, config);
+}
+
+// Launch the next sendmsg() at txtime_ns. Replaces any other cmsgs.
+template<size_t Size>
+inline void set_txtime(BasicMsg<Size>& m, uint64_t txtime_ns) noexcept {
+    static_assert(sizeof(m.cmsg) >= CMSG_SPACE(sizeof(txtime_ns)));
+    memset(m.cmsg, 0, sizeof(m.cmsg));
+
+    struct msghdr mhdr{};
+    mhdr.msg_control    = m.cmsg;
+    mhdr.msg_controllen = sizeof(m.cmsg);
+
+    struct cmsghdr* cmsg{CMSG_FIRSTHDR(&mhdr)};
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_TXTIME;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(txtime_ns));
+    memcpy(CMSG_DATA(cmsg), &txtime_ns, sizeof(txtime_ns));
+}
+#endif
+
+#ifdef __linux__
+// Read and discard whatever is on the socket's error queue, returning
+// how many notifications there were.
+inline size_t drain_error_queue(Socket& s) {
+    size_t drained{0};
+    uint8_t control[256];
+    while (true) {
+        struct msghdr mhdr{};
+        mhdr.msg_control = control;
+        mhdr.msg_controllen = sizeof(control);
+        if (::recvmsg(s.fd, &mhdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        drained++;
+    }
+    return drained;
+}
+#endif
+
+#ifdef SO_ZEROCOPY  // not available on macOS
+// Allow sendmsg(..., MSG_ZEROCOPY): the kernel then sends straight from
+// our buffer, which must stay untouched until a completion for that send
+// comes back on the error queue.
+inline error::Error enable_zerocopy(Socket& s) {
+    return enable(s, SOL_SOCKET, SO_ZEROCOPY);
+}
+
+// Hand each range of completed MSG_ZEROCOPY sends queued so far to
+// fn(first_id, last_id, copied), where sends are numbered from 0 per
+// socket and copied says the kernel fell back to copying after all.
+// Returns how many notifications there were.
+template<typename Fn>
+inline size_t read_zerocopy_completions(Socket& s, Fn&& fn) {
+    size_t count{0};
+    alignas(struct cmsghdr) uint8_t control[256];
+    while (true) {
+        struct msghdr mhdr{};
+        mhdr.msg_control = control;
+        mhdr.msg_controllen = sizeof(control);
+        if (::recvmsg(s.fd, &mhdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mhdr);
+             cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&mhdr, cmsg)) {
+            if ((cmsg->cmsg_level == IPPROTO_IP &&
+                 cmsg->cmsg_type == IP_RECVERR) ||
+                (cmsg->cmsg_level == IPPROTO_IPV6 &&
+                 cmsg->cmsg_type == IPV6_RECVERR)) {
+                struct sock_extended_err err{};
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == 0 &&
+                    err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                    fn(err.ee_info, err.ee_data,
+                       (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+#endif
+
+#ifdef SO_TIMESTAMPING
+// Have the kernel timestamp every datagram sent on s from now on, as it
+// is handed to the device, numbering them from 0.
+inline error::Error enable_tx_timestamps(Socket& s) {
+    const int flags{SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY};
+    return set(s, SOL_SOCKET, SO_TIMESTAMPING, flags);
+}
+
+// Hand each transmit timestamp queued so far to fn(id, when); returns how
+// many there were.
+template<typename Fn>
+inline size_t read_tx_timestamps(Socket& s, Fn&& fn) {
+    size_t count{0};
+    alignas(struct cmsghdr) uint8_t control[256];
+    while (true) {
+        struct msghdr mhdr{};
+        mhdr.msg_control = control;
+        mhdr.msg_controllen = sizeof(control);
+        if (::recvmsg(s.fd, &mhdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        std::optional<struct timespec> when{};
+        std::optional<uint32_t> id{};
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mhdr);
+             cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&mhdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping tss{};
+                memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+                when = tss.ts[0];
+            } else if ((cmsg->cmsg_level == IPPROTO_IP &&
+                        cmsg->cmsg_type == IP_RECVERR) ||
+                       (cmsg->cmsg_level == IPPROTO_IPV6 &&
+                        cmsg->cmsg_type == IPV6_RECVERR)) {
+                struct sock_extended_err err{};
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == ENOMSG &&
+                    err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    id = err.ee_data;
+                }
+            }
+        }
+        if (when.has_value() && id.has_value()) {
+            fn(*id, *when);
+            count++;
+        }
+    }
+    return count;
+}
+#endif
+
+#ifdef SO_BUSY_POLL  // not available on macOS
+// Have receives on s poll the device queue for up to usecs before giving
+// up, rather than wait for an interrupt and a softirq to deliver. Raising
+// it above net.core.busy_read needs CAP_NET_ADMIN.
+inline error::Error enable_busy_poll(Socket& s, int usecs) {
+    const auto e = set(s, SOL_SOCKET, SO_BUSY_POLL, usecs);
+    if (not error::ok(e)) return e;
+#ifdef SO_PREFER_BUSY_POLL  // Linux 5.11
+    // Keep the device's interrupts off for as long as we keep polling, if
+    // we may (CAP_NET_ADMIN) and the kernel knows how; polling works
+    // without it.
+    enable(s, SOL_SOCKET, SO_PREFER_BUSY_POLL);
+#endif
+    return error::success();
+}
+#endif
+
+
+// A fixed ring of Msg buffers and their matching MsgIO headers, so that
+// several datagrams can be moved with a single recvmmsg(2)/sendmmsg(2) call.
+template<size_t Size>
+struct BasicMsgBatch {
+    explicit BasicMsgBatch(size_t n)
+        : msgs(std::max(n, static_cast<size_t>(1))),
+          mios(msgs.size()),
+          lens(msgs.size()) {
+        for (size_t i = 0; i < msgs.size(); i++) {
+            mios[i] = MsgIO::from(msgs[i]);
+            // MsgIO::from() returns a copy; re-point the iovec at our own.
+            mios[i].mhdr.msg_iov = mios[i].iov;
+        }
+#ifdef __linux__
+        mmsgs.resize(msgs.size());
+#endif
+    }
+
+    BasicMsgBatch(const BasicMsgBatch&) = delete;
+    BasicMsgBatch& operator=(const BasicMsgBatch&) = delete;
+
+    size_t size() const noexcept { return msgs.size(); }
+
+    std::vector<BasicMsg<Size>> msgs;
+    std::vector<MsgIO> mios;
+    std::vector<ssize_t> lens;  // per-message byte counts, received or staged
+#ifdef __linux__
+    std::vector<struct mmsghdr> mmsgs;
+#endif
+};
+
+using MsgBatch = BasicMsgBatch<sizeof(Msg)>;
+using JumboMsgBatch = BasicMsgBatch<sizeof(JumboMsg)>;
+
+template<size_t Size>
+inline void reset_for_recv(BasicMsgBatch<Size>& b, size_t i) noexcept {
+    // Only the address and control areas need clearing: the payload is
+    // overwritten by the kernel and bounded by the returned length.
+    auto& m{b.msgs[i]};
+    memset(&(m.ss), 0, sizeof(m.ss));
+    m.ss.ss_family = AF_UNSPEC;
+    memset(m.cmsg, 0, sizeof(m.cmsg));
+
+    auto& mio{b.mios[i]};
+    mio.iov[0].iov_len      = sizeof(m.pckt);
+    mio.mhdr.msg_namelen    = sizeof(m.ss);
+    mio.mhdr.msg_controllen = sizeof(m.cmsg);
+    mio.mhdr.msg_flags      = 0;
+    b.lens[i] = -1;
+}
+
+#ifdef __linux__
+template<size_t Size>
+inline ErrorOr<size_t> recvmmsg_some(Socket& s, BasicMsgBatch<Size>& b,
+                                     size_t first, int flags) {
+    for (size_t i = first; i < b.size(); i++) {
+        reset_for_recv(b, i);
+        b.mmsgs[i].msg_hdr = b.mios[i].mhdr;
+        b.mmsgs[i].msg_len = 0;
+    }
+
+    error::clear();
+    const int rval = ::recvmmsg(s.fd, b.mmsgs.data() + first,
+                                b.size() - first, flags, nullptr);
+    if (rval < 0) {
+        return error::current();
+    }
+    for (size_t i = first; i < first + rval; i++) {
+        b.lens[i] = b.mmsgs[i].msg_len;
+    }
+    return static_cast<size_t>(rval);
+}
+#endif
+
+// Receive up to b.size() datagrams. Blocks until at least one datagram
+// is available, then collects whatever else is queued. If timeout_ms is
+// positive, keeps waiting up to that long for the batch to fill.
+//
+// Returns the number of messages filled; b.lens[i] holds the length of
+// each one.
+template<size_t Size>
+inline ErrorOr<size_t>
+recvmmsg(Socket& s, BasicMsgBatch<Size>& b, int timeout_ms = 0) {
+#ifdef __linux__
+    auto rval{recvmmsg_some(s, b, 0, MSG_WAITFORONE)};
+    if (not ok(rval)) {
+        return rval;
+    }
+    size_t filled{get_valueref_unsafe(rval)};
+
+    if (timeout_ms <= 0) {
+        return filled;
+    }
+
+    const auto deadline{std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms)};
+    while (filled < b.size()) {
+        const auto remaining{std::chrono::duration_cast<
+                std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count()};
+        if (remaining <= 0) break;
+
+        struct pollfd pfd{s.fd, POLLIN, 0};
+        if (::poll(&pfd, 1, static_cast<int>(remaining)) <= 0) break;
+
+        rval = recvmmsg_some(s, b, filled, MSG_DONTWAIT);
+        if (not ok(rval)) break;  // report what we already have
+        filled += get_valueref_unsafe(rval);
+    }
+    return filled;
+#else
+    // No recvmmsg(2); degrade to one datagram per call.
+    (void)timeout_ms;
+    reset_for_recv(b, 0);
+    auto& mio{b.mios[0]};
+
+    error::clear();
+    const ssize_t rval = ::recvmsg(s.fd, &(mio.mhdr), 0);
+    if (rval < 0) {
+        return error::current();
+    }
+    b.lens[0] = rval;
+    return static_cast<size_t>(1);
+#endif
+}
+
+// Send the first `count` messages of the batch, b.lens[i] bytes each.
+// Partial sends are retried until everything is sent or an error occurs.
+//
+// Returns the number of messages sent; an error is returned only if
+// nothing could be sent at all, so a caller learns why a send came up
+// short by retrying the rest.
+template<size_t Size>
+inline ErrorOr<size_t>
+sendmmsg(Socket& s, BasicMsgBatch<Size>& b, size_t count) {
+    count = std::min(count, b.size());
+    for (size_t i = 0; i < count; i++) {
+        prepare_for_send(b.mios[i], b.msgs[i],
+                         static_cast<size_t>(std::max<ssize_t>(b.lens[i], 0)));
+    }
+
+    size_t sent{0};
+    while (sent < count) {
+        error::clear();
+#ifdef __linux__
+        for (size_t i = sent; i < count; i++) {
+            b.mmsgs[i].msg_hdr = b.mios[i].mhdr;
+            b.mmsgs[i].msg_len = 0;
+        }
+        const int rval = ::sendmmsg(s.fd, b.mmsgs.data() + sent,
+                                    count - sent, 0);
+#else
+        const int rval = (::sendmsg(s.fd, &(b.mios[sent].mhdr), 0) < 0)
+                         ? -1 : 1;
+#endif
+        if (rval < 0) {
+            if (sent > 0) break;
+            return error::current();
+        }
+        sent += rval;
+    }
+    return sent;
+}
+
+// Send each of the first `count` iovecs as one datagram on the connected
+// socket s, straight from wherever they point. As for sendmmsg() above,
+// returns the number sent, and an error only if none could be.
+inline ErrorOr<size_t>
+send_iovecs(Socket& s, const struct iovec* iovs, size_t count) {
+    size_t sent{0};
+    while (sent < count) {
+        error::clear();
+#ifdef __linux__
+        constexpr size_t kChunk{64};
+        struct mmsghdr mmsgs[kChunk]{};
+        const size_t n{std::min(count - sent, kChunk)};
+        for (size_t i = 0; i < n; i++) {
+            mmsgs[i].msg_hdr.msg_iov = const_cast<struct iovec*>(iovs + sent + i);
+            mmsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int rval = ::sendmmsg(s.fd, mmsgs, n, 0);
+#else
+        const int rval = (::send(s.fd, iovs[sent].iov_base,
+                                 iovs[sent].iov_len, 0) < 0) ? -1 : 1;
+#endif
+        if (rval < 0) {
+            if (sent > 0) break;
+            return error::current();
+        }
+        sent += rval;
+    }
+    return sent;
+}
+
+
 struct AuxiliaryData {
     std::optional<int> hoplimit{};
     std::optional<int> dscp{};
+    std::optional<int> gro_size{};
+    std::optional<struct timespec> rx_time{};  // kernel arrival time
+    // The NIC's arrival time, on its own clock (PHC): not wall-clock time
+    // unless something keeps that clock on UTC.
+    std::optional<struct timespec> hw_time{};
+    std::optional<uint32_t> dropped{};  // by the socket so far (SO_RXQ_OVFL)
     std::variant<std::monostate,
                  struct in_pktinfo,
                  struct in6_pktinfo> pktinfo{};
@@ -402,6 +834,98 @@ set_dscp(struct AuxiliaryData& aux, const struct cmsghdr* cmsg) noexcept {
     aux.dscp = received_dscp & 0xff;
 }
 
+inline bool has_gro_size(const struct AuxiliaryData& aux) noexcept {
+    return aux.gro_size.has_value();
+}
+inline int get_gro_size(const struct AuxiliaryData& aux) noexcept {
+    return aux.gro_size.value_or(-1);
+}
+
+inline void
+set_gro_size(struct AuxiliaryData& aux, const struct cmsghdr* cmsg) noexcept {
+    if (cmsg == nullptr) return;
+
+    int received_gro_size{0};
+    memcpy(&received_gro_size, CMSG_DATA(cmsg),
+           std::min(sizeof(received_gro_size),
+                    static_cast<size_t>(cmsg->cmsg_len)));
+    aux.gro_size = received_gro_size;
+}
+
+inline bool has_rx_time(const struct AuxiliaryData& aux) noexcept {
+    return aux.rx_time.has_value();
+}
+inline struct timespec get_rx_time(const struct AuxiliaryData& aux) noexcept {
+    return aux.rx_time.value_or(timespec{0, 0});
+}
+
+inline void
+set_rx_time_us(struct AuxiliaryData& aux, const struct cmsghdr* cmsg) noexcept {
+    if (cmsg == nullptr) return;
+
+    struct timeval received_tv{};
+    memcpy(&received_tv, CMSG_DATA(cmsg),
+           std::min(sizeof(received_tv),
+                    static_cast<size_t>(cmsg->cmsg_len)));
+    aux.rx_time = timespec{received_tv.tv_sec,
+                           static_cast<long>(received_tv.tv_usec) * 1000};
+}
+
+inline void
+set_rx_time_ns(struct AuxiliaryData& aux, const struct cmsghdr* cmsg) noexcept {
+    if (cmsg == nullptr) return;
+
+    struct timespec received_ts{};
+    memcpy(&received_ts, CMSG_DATA(cmsg),
+           std::min(sizeof(received_ts),
+                    static_cast<size_t>(cmsg->cmsg_len)));
+    aux.rx_time = received_ts;
+}
+
+inline bool has_hw_time(const struct AuxiliaryData& aux) noexcept {
+    return aux.hw_time.has_value();
+}
+inline struct timespec get_hw_time(const struct AuxiliaryData& aux) noexcept {
+    return aux.hw_time.value_or(timespec{0, 0});
+}
+
+#ifdef SO_TIMESTAMPING
+// SCM_TIMESTAMPING carries {software, legacy, raw hardware}. Only the
+// software stamp is CLOCK_REALTIME; a hardware one is kept apart.
+inline void
+set_rx_timestamping(struct AuxiliaryData& aux,
+                    const struct cmsghdr* cmsg) noexcept {
+    if (cmsg == nullptr) return;
+
+    struct scm_timestamping received_tss{};
+    memcpy(&received_tss, CMSG_DATA(cmsg),
+           std::min(sizeof(received_tss),
+                    static_cast<size_t>(cmsg->cmsg_len)));
+    const auto& sw{received_tss.ts[0]};
+    if (sw.tv_sec != 0 || sw.tv_nsec != 0) aux.rx_time = sw;
+    const auto& hw{received_tss.ts[2]};
+    if (hw.tv_sec != 0 || hw.tv_nsec != 0) aux.hw_time = hw;
+}
+#endif
+
+inline bool has_dropped(const struct AuxiliaryData& aux) noexcept {
+    return aux.dropped.has_value();
+}
+inline uint32_t get_dropped(const struct AuxiliaryData& aux) noexcept {
+    return aux.dropped.value_or(0);
+}
+
+inline void
+set_dropped(struct AuxiliaryData& aux, const struct cmsghdr* cmsg) noexcept {
+    if (cmsg == nullptr) return;
+
+    uint32_t received_dropped{0};
+    memcpy(&received_dropped, CMSG_DATA(cmsg),
+           std::min(sizeof(received_dropped),
+                    static_cast<size_t>(cmsg->cmsg_len)));
+    aux.dropped = received_dropped;
+}
+
 inline bool has_pktinfo(const struct AuxiliaryData& aux) noexcept {
     return not std::holds_alternative<std::monostate>(aux.pktinfo);
 }
@@ -495,6 +1019,45 @@ struct AuxiliaryData parse_aux(const struct msghdr& mhdr) {
                     }
                 break;
 
+            case SOL_SOCKET:
+                switch (cmsg->cmsg_type) {
+#ifdef SCM_TIMESTAMPNS
+                    case SCM_TIMESTAMPNS:
+                        set_rx_time_ns(aux, cmsg);
+                        break;
+#endif
+#ifdef SO_TIMESTAMPING
+                    case SCM_TIMESTAMPING:
+                        set_rx_timestamping(aux, cmsg);
+                        break;
+#endif
+                    case SCM_TIMESTAMP:
+                        set_rx_time_us(aux, cmsg);
+                        break;
+#ifdef SO_RXQ_OVFL
+                    case SO_RXQ_OVFL:
+                        set_dropped(aux, cmsg);
+                        break;
+#endif
+
+                    default:
+                        break;
+                }
+                break;
+
+#ifdef UDP_GRO
+            case SOL_UDP:
+                switch (cmsg->cmsg_type) {
+                    case UDP_GRO:
+                        set_gro_size(aux, cmsg);
+                        break;
+
+                    default:
+                        break;
+                }
+                break;
+#endif
+
             default:
                 // std::cerr << "unhandled cmsg_level: "
                 //           << cmsg->cmsg_level << "\n";
@@ -505,10 +1068,27 @@ struct AuxiliaryData parse_aux(const struct msghdr& mhdr) {
     return aux;
 }
 
-struct AuxiliaryData parse_aux(const Msg& m) {
+template<size_t Size>
+struct AuxiliaryData parse_aux(const BasicMsg<Size>& m) {
     return parse_aux(MsgIO::from(m).mhdr);
 }
 
+// Invoke fn(data, len) once per datagram in a received buffer. A UDP GRO
+// super-datagram is split back into the gro_size-byte datagrams it was
+// coalesced from; the last one may be short.
+template<typename Fn>
+inline void for_each_segment(const uint8_t* data, size_t len,
+                             const struct AuxiliaryData& aux, Fn&& fn) {
+    const int seg{get_gro_size(aux)};
+    if (seg <= 0 || len <= static_cast<size_t>(seg)) {
+        fn(data, len);
+        return;
+    }
+    for (size_t off = 0; off < len; off += seg) {
+        fn(data + off, std::min(static_cast<size_t>(seg), len - off));
+    }
+}
+
 }  // namespace socket
 }  // namespace mcast
 
@@ -0,0 +1,521 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_URING_H
+#define MCAST_URING_H
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// Multishot recvmsg (and its io_uring_recvmsg_out layout) is the newest
+// feature used here; without it the io_uring engine is not built at all.
+#ifdef IORING_RECV_MULTISHOT
+#define MCAST_HAVE_URING 1
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "error.h"
+#include "socket.h"
+
+namespace mcast {
+namespace uring {
+
+inline int setup_syscall(unsigned entries, struct io_uring_params* p) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+inline int enter_syscall(int fd, unsigned to_submit, unsigned min_complete,
+                         unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                      min_complete, flags, nullptr, 0));
+}
+
+inline int register_syscall(int fd, unsigned opcode, void* arg,
+                            unsigned nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode,
+                                      arg, nr_args));
+}
+
+template<typename T>
+inline T load_acquire(const T* p) noexcept {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+inline void store_release(T* p, T v) noexcept {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+
+// An io_uring instance: the fd plus the mmap()d submission and completion
+// queues shared with the kernel.
+struct Ring {
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring(Ring&& other) { *this = std::move(other); }
+
+    ~Ring() {
+        if (sqes != nullptr) ::munmap(sqes, sqes_len);
+        if (cq_ptr != nullptr && cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_len);
+        if (sq_ptr != nullptr) ::munmap(sq_ptr, sq_len);
+        if (fd > -1) ::close(fd);
+    }
+
+    Ring& operator=(const Ring&) = delete;
+    Ring& operator=(Ring&& other) {
+        std::swap(fd, other.fd);
+        std::swap(params, other.params);
+        std::swap(sq_ptr, other.sq_ptr);
+        std::swap(sq_len, other.sq_len);
+        std::swap(cq_ptr, other.cq_ptr);
+        std::swap(cq_len, other.cq_len);
+        std::swap(sqes, other.sqes);
+        std::swap(sqes_len, other.sqes_len);
+        std::swap(sq_tail_local, other.sq_tail_local);
+        return *this;
+    }
+
+    unsigned* sq_field(unsigned off) const noexcept {
+        return reinterpret_cast<unsigned*>(
+                static_cast<uint8_t*>(sq_ptr) + off);
+    }
+    unsigned* cq_field(unsigned off) const noexcept {
+        return reinterpret_cast<unsigned*>(
+                static_cast<uint8_t*>(cq_ptr) + off);
+    }
+    struct io_uring_cqe* cqes() const noexcept {
+        return reinterpret_cast<struct io_uring_cqe*>(
+                static_cast<uint8_t*>(cq_ptr) + params.cq_off.cqes);
+    }
+
+    int fd{-1};
+    struct io_uring_params params{};
+    void* sq_ptr{nullptr};
+    size_t sq_len{0};
+    void* cq_ptr{nullptr};
+    size_t cq_len{0};
+    struct io_uring_sqe* sqes{nullptr};
+    size_t sqes_len{0};
+    unsigned sq_tail_local{0};  // SQEs queued but not yet published
+};
+
+inline ErrorOr<Ring> setup(unsigned entries) {
+    Ring r{};
+
+    // Prefer the cheaper single-issuer task-run mode, available since 6.0.
+    r.params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    error::clear();
+    r.fd = setup_syscall(entries, &(r.params));
+    if (r.fd < 0 && errno == EINVAL) {
+        r.params = {};
+        r.fd = setup_syscall(entries, &(r.params));
+    }
+    if (r.fd < 0) {
+        r.fd = -1;
+        return error::current();
+    }
+
+    const auto& p{r.params};
+    r.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r.sq_len = r.cq_len = std::max(r.sq_len, r.cq_len);
+    }
+
+    void* ptr = ::mmap(nullptr, r.sq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        return error::current();
+    }
+    r.sq_ptr = ptr;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r.cq_ptr = r.sq_ptr;
+    } else {
+        ptr = ::mmap(nullptr, r.cq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            return error::current();
+        }
+        r.cq_ptr = ptr;
+    }
+
+    r.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = ::mmap(nullptr, r.sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        return error::current();
+    }
+    r.sqes = static_cast<struct io_uring_sqe*>(ptr);
+
+    // Identity-map the SQ index array once; SQEs are always used in order.
+    unsigned* array{r.sq_field(p.sq_off.array)};
+    for (unsigned i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+    r.sq_tail_local = *(r.sq_field(p.sq_off.tail));
+
+    return r;
+}
+
+// Next free submission entry, zeroed, or nullptr if the queue is full.
+inline struct io_uring_sqe* get_sqe(Ring& r) noexcept {
+    const unsigned head{load_acquire(r.sq_field(r.params.sq_off.head))};
+    if (r.sq_tail_local - head >= r.params.sq_entries) {
+        return nullptr;
+    }
+
+    const unsigned mask{*(r.sq_field(r.params.sq_off.ring_mask))};
+    auto* sqe{&(r.sqes[r.sq_tail_local & mask])};
+    memset(sqe, 0, sizeof(*sqe));
+    r.sq_tail_local++;
+    return sqe;
+}
+
+// Publish any queued SQEs and wait for at least wait_nr completions.
+inline error::Error submit(Ring& r, unsigned wait_nr) {
+    unsigned* tail{r.sq_field(r.params.sq_off.tail)};
+    const unsigned to_submit{r.sq_tail_local - *tail};
+    store_release(tail, r.sq_tail_local);
+
+    if (to_submit == 0 && wait_nr == 0) {
+        return error::success();
+    }
+
+    while (true) {
+        error::clear();
+        const int rval = enter_syscall(r.fd, to_submit, wait_nr,
+                                       (wait_nr > 0) ? IORING_ENTER_GETEVENTS
+                                                     : 0);
+        if (rval >= 0) {
+            return error::success();
+        }
+        if (errno != EINTR) {
+            return error::current();
+        }
+    }
+}
+
+// Invoke fn(cqe) for every available completion, then release them.
+template<typename Fn>
+inline unsigned for_each_cqe(Ring& r, Fn&& fn) {
+    unsigned* head_p{r.cq_field(r.params.cq_off.head)};
+    const unsigned mask{*(r.cq_field(r.params.cq_off.ring_mask))};
+    const unsigned tail{load_acquire(r.cq_field(r.params.cq_off.tail))};
+
+    unsigned head{*head_p};
+    unsigned seen{0};
+    for (; head != tail; head++, seen++) {
+        fn(r.cqes()[head & mask]);
+    }
+    store_release(head_p, head);
+    return seen;
+}
+
+
+// A ring of equally-sized buffers the kernel picks from when a receive
+// completes ("provided buffers"), so no buffer is tied up per request.
+struct BufferRing {
+    BufferRing() = default;
+    BufferRing(const BufferRing&) = delete;
+    BufferRing(BufferRing&& other) { *this = std::move(other); }
+
+    ~BufferRing() {
+        if (br != nullptr) ::munmap(br, br_len);
+    }
+
+    BufferRing& operator=(const BufferRing&) = delete;
+    BufferRing& operator=(BufferRing&& other) {
+        std::swap(br, other.br);
+        std::swap(br_len, other.br_len);
+        std::swap(storage, other.storage);
+        std::swap(entries, other.entries);
+        std::swap(buf_size, other.buf_size);
+        std::swap(bgid, other.bgid);
+        return *this;
+    }
+
+    uint8_t* buffer(uint16_t bid) noexcept {
+        return storage.data() + static_cast<size_t>(bid) * buf_size;
+    }
+
+    // Not br->bufs: in C++ the uapi flexible-array wrapper starts with an
+    // empty struct, which shifts that member away from offset 0.
+    struct io_uring_buf* slots() noexcept {
+        return reinterpret_cast<struct io_uring_buf*>(br);
+    }
+
+    struct io_uring_buf_ring* br{nullptr};
+    size_t br_len{0};
+    std::vector<uint8_t> storage{};
+    unsigned entries{0};
+    size_t buf_size{0};
+    uint16_t bgid{0};
+};
+
+// Hand buffer `bid` (back) to the kernel.
+inline void recycle(BufferRing& b, uint16_t bid) noexcept {
+    const unsigned mask{b.entries - 1};
+    const uint16_t tail{b.br->tail};
+    auto& buf{b.slots()[tail & mask]};
+    buf.addr = reinterpret_cast<uint64_t>(b.buffer(bid));
+    buf.len = static_cast<uint32_t>(b.buf_size);
+    buf.bid = bid;
+    store_release(&(b.br->tail), static_cast<uint16_t>(tail + 1));
+}
+
+// `entries` must be a power of two.
+inline ErrorOr<BufferRing> register_buffers(Ring& r, unsigned entries,
+                                            size_t buf_size, uint16_t bgid) {
+    BufferRing b{};
+    b.entries = entries;
+    b.buf_size = buf_size;
+    b.bgid = bgid;
+    b.br_len = entries * sizeof(struct io_uring_buf);
+
+    void* ptr = ::mmap(nullptr, b.br_len, PROT_READ | PROT_WRITE,
+                       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return error::current();
+    }
+    b.br = static_cast<struct io_uring_buf_ring*>(ptr);
+    b.storage.resize(entries * buf_size);
+
+    for (unsigned i = 0; i < entries; i++) {
+        recycle(b, static_cast<uint16_t>(i));
+    }
+
+    struct io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(b.br);
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    error::clear();
+    if (register_syscall(r.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return error::current();
+    }
+    return b;
+}
+
+
+// Multishot IORING_OP_RECVMSG over one or more sockets, all sharing a
+// single provided-buffer ring. One armed request per socket keeps posting
+// completions until the kernel runs out of buffers or hits an error.
+struct Receiver {
+    Ring ring{};
+    BufferRing bufs{};
+    std::vector<int> fds{};
+    std::vector<bool> armed{};
+    // Only msg_namelen and msg_controllen are read by multishot recvmsg;
+    // they fix the layout of every completed buffer.
+    struct msghdr mhdr{};
+};
+
+constexpr uint16_t kRecvBufferGroup{0};
+
+inline size_t recv_buffer_size(size_t payload) noexcept {
+    return sizeof(struct io_uring_recvmsg_out) +
+           sizeof(struct sockaddr_storage) +
+           sizeof(socket::Msg::cmsg) +
+           payload;
+}
+
+inline ErrorOr<std::unique_ptr<Receiver>>
+make_receiver(const std::vector<int>& fds, unsigned nbufs, size_t payload) {
+    auto rx{std::make_unique<Receiver>()};
+
+    auto ring_or{setup(std::max(8u, static_cast<unsigned>(2 * fds.size())))};
+    if (not ok(ring_or)) {
+        return get_error(ring_or);
+    }
+    rx->ring = std::move(get_valueref_unsafe(ring_or));
+
+    auto bufs_or{register_buffers(rx->ring, nbufs, recv_buffer_size(payload),
+                                  kRecvBufferGroup)};
+    if (not ok(bufs_or)) {
+        return get_error(bufs_or);
+    }
+    rx->bufs = std::move(get_valueref_unsafe(bufs_or));
+
+    rx->fds = fds;
+    rx->armed.assign(fds.size(), false);
+    rx->mhdr.msg_namelen = sizeof(struct sockaddr_storage);
+    rx->mhdr.msg_controllen = sizeof(socket::Msg::cmsg);
+    return rx;
+}
+
+inline error::Error arm(Receiver& rx, size_t idx) {
+    auto* sqe{get_sqe(rx.ring)};
+    if (sqe == nullptr) {
+        return error::Error{EBUSY};
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = rx.fds[idx];
+    sqe->addr = reinterpret_cast<uint64_t>(&(rx.mhdr));
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = rx.bufs.bgid;
+    sqe->user_data = idx;
+    rx.armed[idx] = true;
+    return error::success();
+}
+
+// Wait for completions, then call fn(idx, from, aux, data, len) for each
+// datagram received on rx.fds[idx]. Requests the kernel disarmed (e.g. the
+// buffer ring ran dry) are re-armed.
+//
+// Returns the number of datagrams delivered.
+template<typename Fn>
+inline ErrorOr<size_t> receive(Receiver& rx, Fn&& fn) {
+    for (size_t i = 0; i < rx.fds.size(); i++) {
+        if (not rx.armed[i]) {
+            const auto e{arm(rx, i)};
+            if (not error::ok(e)) return e;
+        }
+    }
+
+    auto e{submit(rx.ring, 1)};
+    if (not error::ok(e)) {
+        return e;
+    }
+
+    size_t delivered{0};
+    error::Error first_error{error::success()};
+    for_each_cqe(rx.ring, [&](const struct io_uring_cqe& cqe) {
+        const size_t idx{static_cast<size_t>(cqe.user_data)};
+        if (not (cqe.flags & IORING_CQE_F_MORE)) {
+            rx.armed[idx] = false;
+        }
+        if (cqe.res < 0) {
+            // ENOBUFS just means the ring ran dry; re-arming fixes that.
+            if (cqe.res != -ENOBUFS && error::ok(first_error)) {
+                first_error = error::Error{-cqe.res};
+            }
+            return;
+        }
+        if (not (cqe.flags & IORING_CQE_F_BUFFER)) {
+            return;
+        }
+
+        const uint16_t bid{static_cast<uint16_t>(
+                cqe.flags >> IORING_CQE_BUFFER_SHIFT)};
+        const uint8_t* buf{rx.bufs.buffer(bid)};
+        const size_t res{static_cast<size_t>(cqe.res)};
+
+        struct io_uring_recvmsg_out out{};
+        const size_t name_off{sizeof(out)};
+        const size_t ctrl_off{name_off + rx.mhdr.msg_namelen};
+        const size_t data_off{ctrl_off + rx.mhdr.msg_controllen};
+        if (res >= data_off) {
+            memcpy(&out, buf, sizeof(out));
+
+            struct sockaddr_storage from{};
+            memcpy(&from, buf + name_off,
+                   std::min(static_cast<size_t>(out.namelen), sizeof(from)));
+
+            struct msghdr ctrl{};
+            ctrl.msg_control = const_cast<uint8_t*>(buf + ctrl_off);
+            ctrl.msg_controllen = std::min(
+                    static_cast<size_t>(out.controllen),
+                    static_cast<size_t>(rx.mhdr.msg_controllen));
+            const auto aux{socket::parse_aux(ctrl)};
+
+            const size_t len{std::min(static_cast<size_t>(out.payloadlen),
+                                      res - data_off)};
+            fn(idx, from, aux, buf + data_off, len);
+            delivered++;
+        }
+        recycle(rx.bufs, bid);
+    });
+
+    if (delivered == 0 && not error::ok(first_error)) {
+        return first_error;
+    }
+    return delivered;
+}
+
+
+// Linked IORING_OP_SENDMSG chains: a whole batch goes out with one
+// io_uring_enter(), still in order.
+struct Sender {
+    Ring ring{};
+};
+
+inline ErrorOr<std::unique_ptr<Sender>> make_sender(unsigned depth) {
+    auto tx{std::make_unique<Sender>()};
+    auto ring_or{setup(std::max(8u, depth))};
+    if (not ok(ring_or)) {
+        return get_error(ring_or);
+    }
+    tx->ring = std::move(get_valueref_unsafe(ring_or));
+    return tx;
+}
+
+// Same contract as socket::sendmmsg().
+template<size_t Size>
+inline ErrorOr<size_t> sendmmsg(Sender& tx, socket::Socket& s,
+                                socket::BasicMsgBatch<Size>& b, size_t count) {
+    count = std::min({count, b.size(),
+                      static_cast<size_t>(tx.ring.params.sq_entries)});
+
+    for (size_t i = 0; i < count; i++) {
+        socket::prepare_for_send(
+                b.mios[i], b.msgs[i],
+                static_cast<size_t>(std::max<ssize_t>(b.lens[i], 0)));
+
+        auto* sqe{get_sqe(tx.ring)};
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = s.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&(b.mios[i].mhdr));
+        sqe->len = 1;
+        sqe->user_data = i;
+        if (i + 1 < count) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+    }
+
+    size_t completed{0};
+    size_t sent{0};
+    error::Error first_error{error::success()};
+    while (completed < count) {
+        const auto e{submit(tx.ring, 1)};
+        if (not error::ok(e)) {
+            return e;
+        }
+        completed += for_each_cqe(tx.ring, [&](const struct io_uring_cqe& cqe) {
+            if (cqe.res >= 0) {
+                sent++;
+            } else if (cqe.res != -ECANCELED && error::ok(first_error)) {
+                first_error = error::Error{-cqe.res};
+            }
+        });
+    }
+
+    if (sent == 0 && not error::ok(first_error)) {
+        return first_error;
+    }
+    return sent;
+}
+
+}  // namespace uring
+}  // namespace mcast
+
+#endif  // IORING_RECV_MULTISHOT
+
+#endif  // MCAST_URING_H
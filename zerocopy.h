@@ -0,0 +1,113 @@
+/* LICENSE_BEGIN
+
+    Apache 2.0 License
+
+    SPDX:Apache-2.0
+
+    https://spdx.org/licenses/Apache-2.0
+
+    See LICENSE file in the top level directory.
+
+LICENSE_END */
+
+#ifndef MCAST_ZEROCOPY_H
+#define MCAST_ZEROCOPY_H
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "socket.h"
+
+#ifdef SO_ZEROCOPY  // not available on macOS
+#define MCAST_HAVE_ZEROCOPY 1
+#endif
+
+#ifdef MCAST_HAVE_ZEROCOPY
+
+namespace mcast {
+namespace zerocopy {
+
+// Send buffers for MSG_ZEROCOPY. The kernel numbers a socket's zerocopy
+// sends 0, 1, 2, ... and reports their completion in ranges; send id
+// always uses buffer id % size, which is handed out again only once the
+// kernel has let go of it.
+template<size_t Size>
+struct Pool {
+    explicit Pool(size_t n)
+        : msgs(std::max(n, static_cast<size_t>(1))),
+          busy(msgs.size()) {}
+
+    std::vector<socket::BasicMsg<Size>> msgs;
+    std::vector<uint8_t> busy;
+    uint32_t next_id{0};  // the id the kernel will give the next send
+    size_t in_flight{0};
+    uint64_t completions{0};
+    uint64_t copied{0};  // sends the kernel had to copy after all
+};
+
+// Mark the buffers of completed sends free again.
+template<size_t Size>
+inline size_t reap(Pool<Size>& pool, socket::Socket& s) {
+    return socket::read_zerocopy_completions(s,
+            [&pool](uint32_t first, uint32_t last, bool copied) {
+                for (uint32_t id = first;; id++) {
+                    auto& busy{pool.busy[id % pool.msgs.size()]};
+                    if (busy) {
+                        busy = 0;
+                        pool.in_flight--;
+                    }
+                    pool.completions++;
+                    if (copied) pool.copied++;
+                    if (id == last) break;  // ids wrap at 2^32
+                }
+            });
+}
+
+// Wait up to timeout_ms for completions, and reap them.
+template<size_t Size>
+inline size_t wait(Pool<Size>& pool, socket::Socket& s, int timeout_ms) {
+    // Only the error queue makes POLLERR, which is always polled for.
+    struct pollfd pfd{s.fd, 0, 0};
+    ::poll(&pfd, 1, timeout_ms);
+    return reap(pool, s);
+}
+
+// The buffer for the next send, once the kernel is done with it.
+template<size_t Size>
+inline socket::BasicMsg<Size>& acquire(Pool<Size>& pool, socket::Socket& s) {
+    const size_t index{pool.next_id % pool.msgs.size()};
+    reap(pool, s);
+    while (pool.busy[index]) {
+        wait(pool, s, 100);
+    }
+    return pool.msgs[index];
+}
+
+// Call after each successful send with MSG_ZEROCOPY of the buffer from
+// acquire(): it now belongs to the kernel.
+template<size_t Size>
+inline void sent(Pool<Size>& pool) {
+    pool.busy[pool.next_id % pool.msgs.size()] = 1;
+    pool.in_flight++;
+    pool.next_id++;
+}
+
+// Wait for every outstanding send to complete, or for timeout_ms of
+// silence.
+template<size_t Size>
+inline void drain(Pool<Size>& pool, socket::Socket& s, int timeout_ms) {
+    while (pool.in_flight > 0) {
+        if (wait(pool, s, timeout_ms) == 0) break;
+    }
+}
+
+}  // namespace zerocopy
+}  // namespace mcast
+
+#endif  // MCAST_HAVE_ZEROCOPY
+
+#endif  // MCAST_ZEROCOPY_H